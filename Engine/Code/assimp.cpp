@@ -1,6 +1,28 @@
 #include "assimp.h"
+#include "buffer_management.h"
 #include "par-master/par_shapes.h"
 
+void ComputeSubmeshBounds(Submesh& submesh)
+{
+    const u32 stride = submesh.vertexBufferLayout.stride / sizeof(float);
+    const u32 vertexCount = submesh.vertices.size() / stride;
+
+    if (vertexCount == 0)
+    {
+        submesh.aabbMin = submesh.aabbMax = vec3(0.0f);
+        return;
+    }
+
+    // Positions are always the first attribute
+    submesh.aabbMin = submesh.aabbMax = glm::make_vec3(&submesh.vertices[0]);
+    for (u32 i = 1; i < vertexCount; ++i)
+    {
+        const vec3 position = glm::make_vec3(&submesh.vertices[i * stride]);
+        submesh.aabbMin = glm::min(submesh.aabbMin, position);
+        submesh.aabbMax = glm::max(submesh.aabbMax, position);
+    }
+}
+
 void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
 {
     std::vector<float> vertices;
@@ -84,6 +106,7 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
     submesh.vertexBufferLayout = vertexBufferLayout;
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
+    ComputeSubmeshBounds(submesh);
     myMesh->submeshes.push_back( submesh );
 }
 
@@ -143,6 +166,7 @@ void ProcessPrimitive(Mesh* myMesh)
     submesh.vertexBufferLayout = vertexBufferLayout;
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
+    ComputeSubmeshBounds(submesh);
     myMesh->submeshes.push_back(submesh);
 
     if (new_mesh != nullptr)
@@ -195,6 +219,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
         myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.features |= ProgramFeature_NormalMap;
     }
     if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
     {
@@ -202,8 +227,16 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
         myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.features |= ProgramFeature_ReliefMap;
     }
 
+    // Exporters write a preview color next to the albedo texture, only untextured materials use it.
+    // Assimp's default material keeps the placeholder texture.
+    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0 || myMaterial.name == AI_DEFAULT_MATERIAL_NAME)
+        myMaterial.albedo = vec3(1.0f);
+    if (material->GetTextureCount(aiTextureType_DIFFUSE) == 0)
+        myMaterial.albedoTextureIdx = myMaterial.name == AI_DEFAULT_MATERIAL_NAME ? app->whiteTexIdx : app->blankTexIdx;
+
     //myMaterial.createNormalFromBump();
 }
 
@@ -223,6 +256,46 @@ void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 bas
     }
 }
 
+void UploadMesh(App* app, Mesh& mesh)
+{
+    // Offset of each attribute location inside MeshVertex, in floats
+    const u32 canonicalOffsets[] = { 0, 3, 6, 8, 11 };
+    const u32 canonicalFloats = sizeof(MeshVertex) / sizeof(float);
+
+    std::vector<float> vertices;
+
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        const u32 srcFloats = layout.stride / sizeof(float);
+        const u32 vertexCount = submesh.vertices.size() / srcFloats;
+
+        // Attributes missing in the source layout are left to zero
+        vertices.assign(vertexCount * canonicalFloats, 0.0f);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            for (u32 a = 0; a < layout.attributes.size(); ++a)
+            {
+                const VertexBufferAttribute& attribute = layout.attributes[a];
+                if (attribute.location >= ARRAY_COUNT(canonicalOffsets))
+                    continue;
+
+                const float* src = &submesh.vertices[v * srcFloats + attribute.offset / sizeof(float)];
+                float* dst = &vertices[v * canonicalFloats + canonicalOffsets[attribute.location]];
+                for (u32 c = 0; c < attribute.componentCount; ++c)
+                    dst[c] = src[c];
+            }
+        }
+
+        const u32 verticesOffset = AppendData(app->geometryVertexBuff, vertices.data(), vertices.size() * sizeof(float), 1);
+        submesh.baseVertex = verticesOffset / sizeof(MeshVertex);
+
+        const u32 indicesOffset = AppendData(app->geometryIndexBuff, submesh.indices.data(), submesh.indices.size() * sizeof(u32), sizeof(u32));
+        submesh.firstIndex = indicesOffset / sizeof(u32);
+    }
+}
+
 u32 LoadModel(App* app, const char* filename)
 {
     const aiScene* scene = aiImportFile(filename,
@@ -259,6 +332,7 @@ u32 LoadModel(App* app, const char* filename)
         app->materials.push_back(Material{});
         Material& material = app->materials.back();
         ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        LoadMaterialProgramVariants(app, material.features);
     }
 
     if (scene->mNumMaterials == 0) {
@@ -271,43 +345,9 @@ u32 LoadModel(App* app, const char* filename)
 
     aiReleaseImport(scene);
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
-
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
-    }
-
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
-
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
-
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
-    }
+    UploadMesh(app, mesh);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    app->drawListDirty = true;
 
     return modelIdx;
 }
@@ -329,43 +369,9 @@ u32 LoadPlane(App* app)
 
     ProcessPrimitive(&mesh);
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
-
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
-    }
-
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
-
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
-
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
-    }
+    UploadMesh(app, mesh);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    app->drawListDirty = true;
 
     return modelIdx;
 }
\ No newline at end of file
@@ -6,12 +6,18 @@
 #include <assimp/postprocess.h>
 #include <assimp/cimport.h>
 
+// Local space AABB of the submesh positions
+void ComputeSubmeshBounds(Submesh& submesh);
+
 void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 
 void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 
 void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 
+// Converts the submeshes to the canonical vertex format and suballocates them from the geometry arena
+void UploadMesh(App* app, Mesh& mesh);
+
 u32 LoadModel(App* app, const char* filename);
 
 u32 LoadPlane(App* app);
@@ -0,0 +1,145 @@
+#include "bloom.h"
+#include "framegraph.h"
+#include "render_targets.h"
+
+#define BLOOM_TEXTURE_UNIT 0
+
+static ivec2 BloomLevelSize(const App* app, u32 level)
+{
+    const ivec2 size = glm::max(app->renderSize / 2, ivec2(1));
+    return glm::max(ivec2(size.x >> level, size.y >> level), ivec2(1));
+}
+
+void RenderBloomCompute(App* app)
+{
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Render Bloom (compute)");
+
+    const u32 levels = app->bloomChainLevels;
+    glActiveTexture(GL_TEXTURE0 + BLOOM_TEXTURE_UNIT);
+
+    // Downsample, the first level thresholds the color target
+    Program& downsample = app->programs[app->bloomDownsampleIdx];
+    glUseProgram(downsample.handle);
+    glUniform1i(UniformLocation(downsample, UNIFORM("uSource")), BLOOM_TEXTURE_UNIT);
+    glUniform1f(UniformLocation(downsample, UNIFORM("uThreshold")), app->threshold);
+
+    for (u32 level = 0; level < levels; ++level)
+    {
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? app->colorTexHandle : app->rtBright);
+        glUniform1i(UniformLocation(downsample, UNIFORM("uSourceLevel")), level == 0 ? 0 : level - 1);
+        glUniform1i(UniformLocation(downsample, UNIFORM("uPrefilter")), level == 0 ? 1 : 0);
+        glBindImageTexture(0, app->rtBright, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+        const ivec2 size = BloomLevelSize(app, level);
+        glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    // Upsample from the smallest level, each level accumulates the ones below it in place
+    Program& upsample = app->programs[app->bloomUpsampleIdx];
+    glUseProgram(upsample.handle);
+    glUniform1i(UniformLocation(upsample, UNIFORM("uChain")), BLOOM_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, app->rtBright);
+
+    for (i32 level = (i32)levels - 2; level >= 0; --level)
+    {
+        const bool lowest = level == (i32)levels - 2;
+        glUniform1i(UniformLocation(upsample, UNIFORM("uLevel")), level);
+        glUniform1f(UniformLocation(upsample, UNIFORM("uIntensity")), app->bloomIntensity[level]);
+        glUniform1f(UniformLocation(upsample, UNIFORM("uLowerIntensity")), lowest ? app->bloomIntensity[level + 1] : 1.0f);
+        glBindImageTexture(0, app->rtBright, level, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+
+        const ivec2 size = BloomLevelSize(app, level);
+        glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    // With a single level nothing was upsampled, so its weight is applied here
+    Program& composite = app->programs[app->bloomCompositeIdx];
+    glUseProgram(composite.handle);
+    glUniform1i(UniformLocation(composite, UNIFORM("uBloom")), BLOOM_TEXTURE_UNIT);
+    glUniform1f(UniformLocation(composite, UNIFORM("uIntensity")), levels == 1 ? app->bloomIntensity[0] : 1.0f);
+    glBindImageTexture(0, app->colorTexHandle, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+
+    glDispatchCompute((app->renderSize.x + 7) / 8, (app->renderSize.y + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glPopDebugGroup();
+}
+
+void RunBloomBenchmark(App* app)
+{
+    const ivec2 sizes[] = { ivec2(1920, 1080), ivec2(3840, 2160) };
+    const u32 iterations = 10;
+
+    const ivec2 renderSize = app->renderSize;
+    const GLuint colorTexHandle = app->colorTexHandle;
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    // Average GPU time of the bloom, the result is waited for so runs do not overlap
+    auto timeBloom = [&](auto&& bloom) {
+        u64 total = 0;
+        for (u32 it = 0; it < iterations; ++it)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            bloom();
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            total += elapsed;
+        }
+        return (f64)total / iterations / 1e6;
+    };
+
+    GLuint readFramebuffer;
+    glGenFramebuffers(1, &readFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorTexHandle, 0);
+
+    for (u32 s = 0; s < ARRAY_COUNT(sizes); ++s)
+    {
+        // The bloom targets are allocated for the benchmark size, the color target is the current
+        // frame scaled up so the threshold keeps about the same pixels
+        app->renderSize = sizes[s];
+        app->colorTexHandle = AcquireRenderTarget(app->renderTargets, sizes[s], GL_RGBA8);
+        FrameBufferObjectBloom(app);
+
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->colorTexHandle, 0);
+
+        auto refill = [&]() {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+            glBlitFramebuffer(0, 0, renderSize.x, renderSize.y, 0, 0, sizes[s].x, sizes[s].y, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        };
+
+        refill();
+        const f64 fragment = timeBloom([&]() { RenderBloom(app, framebuffer); });
+        refill();
+        const f64 compute = timeBloom([&]() { RenderBloomCompute(app); });
+
+        ILOG("Bloom %4dx%4d, %u levels: fragment %8.3f ms, compute %8.3f ms (x%.1f)", sizes[s].x, sizes[s].y, app->bloomChainLevels, fragment, compute, fragment / compute);
+
+        glDeleteFramebuffers(1, &framebuffer);
+        ReleaseRenderTarget(app->renderTargets, app->colorTexHandle);
+    }
+
+    glDeleteFramebuffers(1, &readFramebuffer);
+    glDeleteQueries(1, &query);
+
+    // The benchmark targets go now instead of after the idle trim, like the targets of a resize
+    BeginRenderTargetGeneration(app->renderTargets);
+    app->renderSize = renderSize;
+    app->colorTexHandle = colorTexHandle;
+    FrameBufferObjectBloom(app);
+    if (TrimRenderTargets(app->renderTargets))
+        FGReleaseFramebuffers(app->frameGraph);
+}
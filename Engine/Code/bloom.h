@@ -0,0 +1,16 @@
+//
+// bloom.h: Compute bloom. The bright pixels of the color target are downsampled along the
+// mip chain with a 13 tap filter (a Karis average on the first level), upsampled back with
+// a tent filter accumulating every level, and added to the color target. Each pass loads the
+// texels its group needs into shared memory, so every texel is fetched once per level.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Adds the bloom of colorTexHandle on top of it, through the rtBright mip chain
+void RenderBloomCompute(App* app);
+
+// Times the fragment and compute bloom at 1080p and 4K and logs the results
+void RunBloomBenchmark(App* app);
@@ -0,0 +1,120 @@
+#include "blur.h"
+#include <string>
+
+const u32 BlurRadiusPresets[BLUR_RADIUS_PRESET_COUNT] = { 0, 2, 4, 8, 12, 16, 24, 32, 50 };
+
+static u32 AddBlurKernel(App* app, BlurKernelType type, const f32* weights, u32 radius)
+{
+    f32 sum = weights[0];
+    for (u32 i = 1; i <= radius; ++i)
+        sum += 2.0f * weights[i];
+
+    BlurKernel kernel = {};
+    kernel.type = type;
+    kernel.radius = radius;
+
+    // Two neighbouring taps i, i + 1 are one bilinear fetch between them, placed by their weights
+    kernel.offsets.push_back(0.0f);
+    kernel.weights.push_back(weights[0] / sum);
+    for (u32 i = 1; i <= radius; i += 2)
+    {
+        const f32 w0 = weights[i];
+        const f32 w1 = i + 1 <= radius ? weights[i + 1] : 0.0f;
+        const f32 w = w0 + w1;
+        if (w <= 0.0f)
+            continue;
+
+        kernel.offsets.push_back((i * w0 + (i + 1) * w1) / w);
+        kernel.weights.push_back(w / sum);
+    }
+
+    std::string offsets, taps;
+    char value[32];
+    for (u32 i = 0; i < kernel.offsets.size(); ++i)
+    {
+        sprintf(value, "%s%.8f", i > 0 ? ", " : "", kernel.offsets[i]);
+        offsets += value;
+        sprintf(value, "%s%.8f", i > 0 ? ", " : "", kernel.weights[i]);
+        taps += value;
+    }
+
+    char tapCount[64];
+    sprintf(tapCount, "#define BLUR_TAP_COUNT %u\n", (u32)kernel.offsets.size());
+    const std::string defines = std::string(tapCount)
+        + "#define BLUR_OFFSETS float[](" + offsets + ")\n"
+        + "#define BLUR_WEIGHTS float[](" + taps + ")\n";
+
+    kernel.programIdx = LoadProgram(app, "shaders.glsl", "Mode_BlurSeparable", defines.c_str());
+
+    app->blurKernels.push_back(kernel);
+    return app->blurKernels.size() - 1;
+}
+
+static u32 AddBlurKernel(App* app, BlurKernelType type, u32 radius)
+{
+    std::vector<f32> weights(radius + 1);
+    const f32 sigma = glm::max(radius / 3.0f, 0.5f);
+    for (u32 i = 0; i <= radius; ++i)
+    {
+        if (type == BlurKernel_Gaussian)
+        {
+            weights[i] = expf(-(f32)(i * i) / (2.0f * sigma * sigma));
+        }
+        else
+        {
+            weights[i] = 1.0f - glm::smoothstep(0.0f, (f32)glm::max(radius, 1u), (f32)i);
+        }
+    }
+
+    return AddBlurKernel(app, type, weights.data(), radius);
+}
+
+u32 GetBlurKernel(App* app, BlurKernelType type, u32 radius)
+{
+    bool presetsBuilt = false;
+    for (u32 i = 0; i < app->blurKernels.size(); ++i)
+    {
+        if (app->blurKernels[i].type == type && app->blurKernels[i].radius == radius)
+            return i;
+        presetsBuilt |= app->blurKernels[i].type == type;
+    }
+
+    if (!presetsBuilt)
+        for (u32 i = 0; i < BLUR_RADIUS_PRESET_COUNT; ++i)
+            if (BlurRadiusPresets[i] != radius)
+                AddBlurKernel(app, type, BlurRadiusPresets[i]);
+
+    return AddBlurKernel(app, type, radius);
+}
+
+u32 CreateBlurKernel(App* app, const f32* weights, u32 radius)
+{
+    return AddBlurKernel(app, BlurKernel_Custom, weights, radius);
+}
+
+void BlurPass(App* app, u32 kernel, GLuint framebuffer, GLenum attachment, ivec2 size, GLuint input, u32 lod, vec2 direction)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(attachment);
+    glViewport(0, 0, size.x, size.y);
+
+    glDisable(GL_DEPTH_TEST);
+
+    Program& program = app->programs[app->blurKernels[kernel].programIdx];
+    glUseProgram(program.handle);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input);
+    glUniform1i(UniformLocation(program, UNIFORM("uInput")), 0);
+    glUniform1i(UniformLocation(program, UNIFORM("uInputLod")), lod);
+    glUniform2f(UniformLocation(program, UNIFORM("uDirection")), direction.x, direction.y);
+
+    //DRAW Quad
+    glBindVertexArray(app->quadVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,27 @@
+//
+// blur.h: Separable blur. Kernel weights are computed once on the CPU, adjacent taps are folded
+// into single bilinear fetches (halving the samples) and every kernel gets a Mode_BlurSeparable
+// variant with its tables as constants, so the shader loop is fully unrolled for its size.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define BLUR_RADIUS_PRESET_COUNT 9
+
+// Radii the UI offers, the first kernel asked for of a type builds them all so changing the
+// radius afterwards never compiles
+extern const u32 BlurRadiusPresets[BLUR_RADIUS_PRESET_COUNT];
+
+// Index of the Gaussian (sigma = radius / 3) or smoothstep kernel of this radius, created the
+// first time it is asked for along with the presets of its type
+u32 GetBlurKernel(App* app, BlurKernelType type, u32 radius);
+
+// Kernel from one side of a symmetric weight table: weights[0] is the center and weights[radius]
+// the outermost tap. The weights are normalized, the caller keeps the returned index.
+u32 CreateBlurKernel(App* app, const f32* weights, u32 radius);
+
+// Blurs level lod of input along direction (in texels, (1, 0) or (0, 1)) into the attachment of
+// framebuffer, size is the size of the attachment. The input must be filtered linearly.
+void BlurPass(App* app, u32 kernel, GLuint framebuffer, GLenum attachment, ivec2 size, GLuint input, u32 lod, vec2 direction);
@@ -1,6 +1,7 @@
 //#include "buffer_management.h"
 
 #include "engine.h"
+#include "gl_extensions.h"
 
 bool IsPowerOf2(u32 value)
 {
@@ -26,6 +27,120 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage)
     return buffer;
 }
 
+Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type)
+{
+    ASSERT(regionCount > 0 && regionCount <= MAX_FRAMES_IN_FLIGHT, "Unsupported number of frames in flight");
+
+    Buffer buffer = {};
+    buffer.regionSize = Align(regionSize, 256); // 256 is the largest offset alignment allowed by the spec
+    buffer.regionCount = regionCount;
+    buffer.regionIdx = regionCount - 1;
+    buffer.size = buffer.regionSize * regionCount;
+    buffer.type = type;
+
+    glGenBuffers(1, &buffer.handle);
+    glBindBuffer(type, buffer.handle);
+
+    if (GLExt.bufferStorage)
+    {
+        // Mapped once for the whole lifetime of the buffer, writes are visible to the GPU without flushing
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(type, buffer.size, NULL, flags);
+        buffer.data = glMapBufferRange(type, 0, buffer.size, flags);
+        buffer.persistent = buffer.data != NULL;
+    }
+
+    if (!buffer.persistent)
+    {
+        // Fallback: mapped every frame, unsynchronized since the fences already protect each region
+        glBufferData(type, buffer.size, NULL, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(type, 0);
+
+    return buffer;
+}
+
+Buffer CreateReadbackBuffer(u32 size, GLenum type)
+{
+    Buffer buffer = {};
+    buffer.size = size;
+    buffer.type = type;
+
+    glGenBuffers(1, &buffer.handle);
+    glBindBuffer(type, buffer.handle);
+
+    if (GLExt.bufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(type, buffer.size, NULL, flags);
+        buffer.data = glMapBufferRange(type, 0, buffer.size, flags);
+        buffer.persistent = buffer.data != NULL;
+    }
+
+    if (!buffer.persistent)
+    {
+        // Fallback: read with glGetBufferSubData
+        glBufferData(type, buffer.size, NULL, GL_DYNAMIC_READ);
+    }
+
+    glBindBuffer(type, 0);
+
+    return buffer;
+}
+
+void BeginRingRegion(Buffer& buffer)
+{
+    ASSERT(buffer.regionCount > 0, "The buffer is not a ring buffer");
+
+    buffer.regionIdx = (buffer.regionIdx + 1) % buffer.regionCount;
+
+    // Wait until the GPU is done with the commands that read this region the last time
+    GLsync& fence = buffer.fences[buffer.regionIdx];
+    if (fence)
+    {
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+        if (result == GL_WAIT_FAILED)
+            ELOG("glClientWaitSync() failed waiting for a ring buffer region");
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    if (!buffer.persistent)
+    {
+        const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+        glBindBuffer(buffer.type, buffer.handle);
+        buffer.data = glMapBufferRange(buffer.type, 0, buffer.size, access);
+    }
+
+    // Offsets pushed by the caller stay absolute, so they can be used directly in glBindBufferRange
+    buffer.head = buffer.regionIdx * buffer.regionSize;
+    buffer.end = buffer.head + buffer.regionSize;
+}
+
+void EndRingRegion(Buffer& buffer)
+{
+    if (!buffer.persistent)
+    {
+        const u32 regionOffset = buffer.regionIdx * buffer.regionSize;
+        glFlushMappedBufferRange(buffer.type, regionOffset, buffer.head - regionOffset);
+        glUnmapBuffer(buffer.type);
+        glBindBuffer(buffer.type, 0);
+        buffer.data = NULL;
+    }
+}
+
+void FenceRingRegion(Buffer& buffer)
+{
+    GLsync& fence = buffer.fences[buffer.regionIdx];
+    if (fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
 void BindBuffer(const Buffer& buffer)
 {
     glBindBuffer(buffer.type, buffer.handle);
@@ -36,6 +151,7 @@ void MapBuffer(Buffer& buffer, GLenum access)
     glBindBuffer(buffer.type, buffer.handle);
     buffer.data = (u8*)glMapBuffer(buffer.type, access);
     buffer.head = 0;
+    buffer.end = buffer.size;
 }
 
 void UnmapBuffer(Buffer& buffer)
@@ -50,10 +166,34 @@ void AlignHead(Buffer& buffer, u32 alignment)
     buffer.head = Align(buffer.head, alignment);
 }
 
+u32 AppendData(Buffer& buffer, const void* data, u32 size, u32 alignment)
+{
+    AlignHead(buffer, alignment);
+    ASSERT(buffer.head + size <= buffer.size, "Trying to append more data than the buffer can hold");
+
+    const u32 offset = buffer.head;
+    glBindBuffer(buffer.type, buffer.handle);
+    glBufferSubData(buffer.type, offset, size, data);
+    glBindBuffer(buffer.type, 0);
+    buffer.head += size;
+
+    return offset;
+}
+
+void UpdateData(Buffer& buffer, u32 offset, const void* data, u32 size)
+{
+    ASSERT(offset + size <= buffer.size, "Trying to update a range past the end of the buffer");
+
+    glBindBuffer(buffer.type, buffer.handle);
+    glBufferSubData(buffer.type, offset, size, data);
+    glBindBuffer(buffer.type, 0);
+}
+
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
     ASSERT(buffer.data != NULL, "The buffer must be mapped first");
     AlignHead(buffer, alignment);
+    ASSERT(buffer.head + size <= buffer.end, "Trying to push more data than the buffer can hold");
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
-}
\ No newline at end of file
+}
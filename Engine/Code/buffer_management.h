@@ -12,6 +12,23 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage);
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
 
+// Ring buffers keep one region per frame in flight. Each frame writes its own region
+// (BeginRingRegion/EndRingRegion) and fences it once the draws reading it are submitted
+// (FenceRingRegion), so the CPU never waits on the GPU unless it gets too far ahead.
+Buffer CreateRingBuffer(u32 regionSize, u32 regionCount, GLenum type);
+
+// GPU written data the CPU reads back, e.g. counters. Persistently mapped and coherent when
+// buffer storage is available, so reads after a fence never synchronize on the buffer object.
+Buffer CreateReadbackBuffer(u32 size, GLenum type);
+
+#define CreateConstantRingBuffer(size, frames) CreateRingBuffer(size, frames, GL_UNIFORM_BUFFER)
+
+void BeginRingRegion(Buffer& buffer);
+
+void EndRingRegion(Buffer& buffer);
+
+void FenceRingRegion(Buffer& buffer);
+
 void BindBuffer(const Buffer& buffer);
 
 void MapBuffer(Buffer& buffer, GLenum access);
@@ -20,6 +37,12 @@ void UnmapBuffer(Buffer& buffer);
 
 void AlignHead(Buffer& buffer, u32 alignment);
 
+// Copies data at the head of an unmapped buffer (e.g. a static arena) and returns its offset
+u32 AppendData(Buffer& buffer, const void* data, u32 size, u32 alignment);
+
+// Overwrites a range of an unmapped buffer, e.g. the entries of a persistent array that changed
+void UpdateData(Buffer& buffer, u32 offset, const void* data, u32 size);
+
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
@@ -0,0 +1,353 @@
+#include "bvh.h"
+#include <algorithm>
+#include <float.h>
+
+#define BVH_SAH_BINS          12
+#define BVH_REBUILD_THRESHOLD 1.3f // rebuild once refits make the tree this much worse
+#define BVH_STACK_SIZE        64
+#define BVH_MAX_SAH_DEPTH     32 // deeper nodes split at the median, so the tree stays under BVH_STACK_SIZE levels
+
+static f32 SurfaceArea(const vec3& aabbMin, const vec3& aabbMax)
+{
+    const vec3 d = glm::max(aabbMax - aabbMin, vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+void EntityWorldBounds(const App* app, u32 entityIdx, vec3& aabbMin, vec3& aabbMax)
+{
+    const Entity& entity = app->entities[entityIdx];
+    const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+    const glm::mat4& world = entity.worldMatrix;
+    const glm::mat3 absWorld = glm::mat3(glm::abs(vec3(world[0])), glm::abs(vec3(world[1])), glm::abs(vec3(world[2])));
+
+    aabbMin = vec3(FLT_MAX);
+    aabbMax = vec3(-FLT_MAX);
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        const vec3 center = vec3(world * vec4((submesh.aabbMin + submesh.aabbMax) * 0.5f, 1.0f));
+        const vec3 extent = absWorld * ((submesh.aabbMax - submesh.aabbMin) * 0.5f);
+        aabbMin = glm::min(aabbMin, center - extent);
+        aabbMax = glm::max(aabbMax, center + extent);
+    }
+}
+
+struct BVHBuildItem
+{
+    u32  entityIdx;
+    vec3 aabbMin;
+    vec3 aabbMax;
+    vec3 centroid;
+};
+
+static i32 BuildNode(SceneBVH& bvh, BVHBuildItem* items, u32 count, i32 parent, u32 depth)
+{
+    const i32 nodeIdx = (i32)bvh.nodes.size();
+    bvh.nodes.push_back(BVHNode{});
+
+    BVHNode node = {};
+    node.parent = parent;
+    node.entityIdx = -1;
+    node.aabbMin = vec3(FLT_MAX);
+    node.aabbMax = vec3(-FLT_MAX);
+
+    vec3 centroidMin = vec3(FLT_MAX), centroidMax = vec3(-FLT_MAX);
+    for (u32 i = 0; i < count; ++i)
+    {
+        node.aabbMin = glm::min(node.aabbMin, items[i].aabbMin);
+        node.aabbMax = glm::max(node.aabbMax, items[i].aabbMax);
+        centroidMin = glm::min(centroidMin, items[i].centroid);
+        centroidMax = glm::max(centroidMax, items[i].centroid);
+    }
+
+    if (count == 1)
+    {
+        node.entityIdx = items[0].entityIdx;
+        node.left = node.right = -1;
+        bvh.entityLeaves[items[0].entityIdx] = nodeIdx;
+        bvh.nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+
+    // Bin the centroids along the widest axis and pick the split with the lowest SAH cost
+    const vec3 centroidExtent = centroidMax - centroidMin;
+    const u32 axis = centroidExtent.x > centroidExtent.y ? (centroidExtent.x > centroidExtent.z ? 0 : 2) : (centroidExtent.y > centroidExtent.z ? 1 : 2);
+
+    u32 splitCount = count / 2;
+    if (centroidExtent[axis] > 0.0f && depth < BVH_MAX_SAH_DEPTH)
+    {
+        u32  binCounts[BVH_SAH_BINS] = {};
+        vec3 binMin[BVH_SAH_BINS], binMax[BVH_SAH_BINS];
+        for (u32 b = 0; b < BVH_SAH_BINS; ++b)
+        {
+            binMin[b] = vec3(FLT_MAX);
+            binMax[b] = vec3(-FLT_MAX);
+        }
+
+        const f32 binScale = BVH_SAH_BINS / centroidExtent[axis];
+        auto binOf = [&](const BVHBuildItem& item)
+        {
+            return glm::min((u32)((item.centroid[axis] - centroidMin[axis]) * binScale), (u32)BVH_SAH_BINS - 1);
+        };
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            const u32 b = binOf(items[i]);
+            binCounts[b]++;
+            binMin[b] = glm::min(binMin[b], items[i].aabbMin);
+            binMax[b] = glm::max(binMax[b], items[i].aabbMax);
+        }
+
+        // Sweep from the right to get the area of every right side, then from the left
+        f32 rightArea[BVH_SAH_BINS];
+        u32 rightCount[BVH_SAH_BINS];
+        vec3 accMin = vec3(FLT_MAX), accMax = vec3(-FLT_MAX);
+        u32 accCount = 0;
+        for (i32 b = BVH_SAH_BINS - 1; b > 0; --b)
+        {
+            accMin = glm::min(accMin, binMin[b]);
+            accMax = glm::max(accMax, binMax[b]);
+            accCount += binCounts[b];
+            rightArea[b] = SurfaceArea(accMin, accMax);
+            rightCount[b] = accCount;
+        }
+
+        f32 bestCost = FLT_MAX;
+        u32 bestBin = 0;
+        accMin = vec3(FLT_MAX), accMax = vec3(-FLT_MAX);
+        accCount = 0;
+        for (u32 b = 1; b < BVH_SAH_BINS; ++b)
+        {
+            accMin = glm::min(accMin, binMin[b - 1]);
+            accMax = glm::max(accMax, binMax[b - 1]);
+            accCount += binCounts[b - 1];
+            if (accCount == 0 || rightCount[b] == 0)
+                continue;
+
+            const f32 cost = SurfaceArea(accMin, accMax) * accCount + rightArea[b] * rightCount[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestBin = b;
+            }
+        }
+
+        if (bestBin > 0)
+            splitCount = (u32)(std::partition(items, items + count, [&](const BVHBuildItem& item) { return binOf(item) < bestBin; }) - items);
+    }
+
+    // Coincident centroids, a degenerate split or too deep, fall back to halving the list
+    if (splitCount == 0 || splitCount == count || depth >= BVH_MAX_SAH_DEPTH)
+    {
+        splitCount = count / 2;
+        std::nth_element(items, items + splitCount, items + count,
+                         [axis](const BVHBuildItem& a, const BVHBuildItem& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    node.left = BuildNode(bvh, items, splitCount, nodeIdx, depth + 1);
+    node.right = BuildNode(bvh, items + splitCount, count - splitCount, nodeIdx, depth + 1);
+    bvh.nodes[nodeIdx] = node;
+    return nodeIdx;
+}
+
+void BuildSceneBVH(App* app)
+{
+    SceneBVH& bvh = app->sceneBVH;
+    bvh.nodes.clear();
+    bvh.entityLeaves.assign(app->entities.size(), -1);
+    bvh.root = -1;
+
+    if (app->entities.empty())
+        return;
+
+    std::vector<BVHBuildItem> items(app->entities.size());
+    for (u32 i = 0; i < items.size(); ++i)
+    {
+        items[i].entityIdx = i;
+        EntityWorldBounds(app, i, items[i].aabbMin, items[i].aabbMax);
+        items[i].centroid = (items[i].aabbMin + items[i].aabbMax) * 0.5f;
+    }
+
+    bvh.nodes.reserve(2 * items.size() - 1);
+    bvh.root = BuildNode(bvh, items.data(), items.size(), -1, 0);
+    bvh.builtCost = SceneBVHCost(bvh);
+    bvh.rebuildCount++;
+}
+
+f32 SceneBVHCost(const SceneBVH& bvh)
+{
+    if (bvh.root < 0)
+        return 0.0f;
+
+    const BVHNode& root = bvh.nodes[bvh.root];
+    const f32 rootArea = glm::max(SurfaceArea(root.aabbMin, root.aabbMax), FLT_MIN);
+
+    f32 cost = 0.0f;
+    for (u32 i = 0; i < bvh.nodes.size(); ++i)
+        cost += SurfaceArea(bvh.nodes[i].aabbMin, bvh.nodes[i].aabbMax) / rootArea;
+    return cost;
+}
+
+void UpdateSceneBVH(App* app)
+{
+    SceneBVH& bvh = app->sceneBVH;
+    if (bvh.root < 0 || bvh.entityLeaves.size() != app->entities.size())
+    {
+        BuildSceneBVH(app);
+        return;
+    }
+
+    bool refitted = false;
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        if (!app->entities[i].dirty)
+            continue;
+
+        i32 nodeIdx = bvh.entityLeaves[i];
+        EntityWorldBounds(app, i, bvh.nodes[nodeIdx].aabbMin, bvh.nodes[nodeIdx].aabbMax);
+
+        // Grow or shrink the ancestors until one of them does not change
+        for (nodeIdx = bvh.nodes[nodeIdx].parent; nodeIdx >= 0; nodeIdx = bvh.nodes[nodeIdx].parent)
+        {
+            BVHNode& node = bvh.nodes[nodeIdx];
+            const vec3 aabbMin = glm::min(bvh.nodes[node.left].aabbMin, bvh.nodes[node.right].aabbMin);
+            const vec3 aabbMax = glm::max(bvh.nodes[node.left].aabbMax, bvh.nodes[node.right].aabbMax);
+            if (aabbMin == node.aabbMin && aabbMax == node.aabbMax)
+                break;
+            node.aabbMin = aabbMin;
+            node.aabbMax = aabbMax;
+        }
+        refitted = true;
+    }
+
+    if (refitted && SceneBVHCost(bvh) > bvh.builtCost * BVH_REBUILD_THRESHOLD)
+        BuildSceneBVH(app);
+}
+
+// 0: outside, 1: intersecting, 2: fully inside
+static u32 ClassifyFrustum(const Frustum& frustum, const BVHNode& node)
+{
+    const vec3 center = (node.aabbMin + node.aabbMax) * 0.5f;
+    const vec3 extent = (node.aabbMax - node.aabbMin) * 0.5f;
+
+    u32 result = 2;
+    for (u32 p = 0; p < 6; ++p)
+    {
+        const vec4& plane = frustum.planes[p];
+        const f32 distance = glm::dot(vec3(plane), center) + plane.w;
+        const f32 radius = glm::dot(glm::abs(vec3(plane)), extent);
+        if (distance + radius < 0.0f)
+            return 0;
+        if (distance - radius < 0.0f)
+            result = 1;
+    }
+    return result;
+}
+
+static void CollectLeaves(const SceneBVH& bvh, i32 nodeIdx, std::vector<u32>& entities)
+{
+    i32 stack[BVH_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = nodeIdx;
+
+    while (stackSize > 0)
+    {
+        const BVHNode& node = bvh.nodes[stack[--stackSize]];
+        if (node.entityIdx >= 0)
+        {
+            entities.push_back(node.entityIdx);
+            continue;
+        }
+        ASSERT(stackSize + 2 <= BVH_STACK_SIZE, "BVH too deep");
+        stack[stackSize++] = node.left;
+        stack[stackSize++] = node.right;
+    }
+}
+
+void QueryFrustum(const SceneBVH& bvh, const Frustum& frustum, std::vector<u32>& entities)
+{
+    if (bvh.root < 0)
+        return;
+
+    i32 stack[BVH_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = bvh.root;
+
+    while (stackSize > 0)
+    {
+        const i32 nodeIdx = stack[--stackSize];
+        const BVHNode& node = bvh.nodes[nodeIdx];
+
+        const u32 classification = ClassifyFrustum(frustum, node);
+        if (classification == 0)
+            continue;
+
+        // Whole subtree inside, no need to test its children
+        if (classification == 2 || node.entityIdx >= 0)
+        {
+            CollectLeaves(bvh, nodeIdx, entities);
+            continue;
+        }
+
+        ASSERT(stackSize + 2 <= BVH_STACK_SIZE, "BVH too deep");
+        stack[stackSize++] = node.left;
+        stack[stackSize++] = node.right;
+    }
+}
+
+// Slab test, returns the entry distance or FLT_MAX on a miss
+static f32 IntersectRay(const BVHNode& node, const vec3& origin, const vec3& inverseDirection)
+{
+    const vec3 t0 = (node.aabbMin - origin) * inverseDirection;
+    const vec3 t1 = (node.aabbMax - origin) * inverseDirection;
+    const vec3 tNear = glm::min(t0, t1);
+    const vec3 tFar = glm::max(t0, t1);
+    const f32 enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    const f32 exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+i32 QueryRay(const SceneBVH& bvh, const vec3& origin, const vec3& direction, f32& distance)
+{
+    distance = FLT_MAX;
+    if (bvh.root < 0)
+        return -1;
+
+    const vec3 inverseDirection = 1.0f / direction;
+    i32 closest = -1;
+
+    i32 stack[BVH_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = bvh.root;
+
+    while (stackSize > 0)
+    {
+        const BVHNode& node = bvh.nodes[stack[--stackSize]];
+        if (IntersectRay(node, origin, inverseDirection) >= distance)
+            continue;
+
+        if (node.entityIdx >= 0)
+        {
+            distance = IntersectRay(node, origin, inverseDirection);
+            closest = node.entityIdx;
+            continue;
+        }
+
+        // Visit the nearer child first so farther subtrees get pruned by the closer hit
+        const f32 leftDistance = IntersectRay(bvh.nodes[node.left], origin, inverseDirection);
+        const f32 rightDistance = IntersectRay(bvh.nodes[node.right], origin, inverseDirection);
+        ASSERT(stackSize + 2 <= BVH_STACK_SIZE, "BVH too deep");
+        if (leftDistance < rightDistance)
+        {
+            if (rightDistance < distance) stack[stackSize++] = node.right;
+            if (leftDistance < distance)  stack[stackSize++] = node.left;
+        }
+        else
+        {
+            if (leftDistance < distance)  stack[stackSize++] = node.left;
+            if (rightDistance < distance) stack[stackSize++] = node.right;
+        }
+    }
+
+    return closest;
+}
@@ -0,0 +1,29 @@
+//
+// bvh.h: Dynamic bounding volume hierarchy over the world bounds of the scene entities.
+// Moved entities are refitted incrementally, and the tree is rebuilt with the surface
+// area heuristic when entities are added or refits degraded it too much.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "culling.h"
+
+// World space AABB enclosing every submesh of the entity
+void EntityWorldBounds(const App* app, u32 entityIdx, vec3& aabbMin, vec3& aabbMax);
+
+void BuildSceneBVH(App* app);
+
+// Refits the leaves of the entities marked dirty (it does not clear the flags) and
+// rebuilds the tree if the entity count changed or its cost grew past a threshold
+void UpdateSceneBVH(App* app);
+
+// Sum of the node surface areas relative to the root, lower is better
+f32 SceneBVHCost(const SceneBVH& bvh);
+
+// Entities whose bounds intersect the frustum
+void QueryFrustum(const SceneBVH& bvh, const Frustum& frustum, std::vector<u32>& entities);
+
+// Closest entity whose bounds the ray hits, or -1. distance receives the hit distance
+// along direction, which must be normalized.
+i32 QueryRay(const SceneBVH& bvh, const vec3& origin, const vec3& direction, f32& distance);
@@ -0,0 +1,59 @@
+#include "clustered.h"
+#include "buffer_management.h"
+
+void CreateClusterBuffers(App* app)
+{
+    // Offset and count of the light list of each cluster
+    app->clusterGridBuff = CreateBuffer(CLUSTER_COUNT * 2 * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+
+    // Clusters keep at most CLUSTER_MAX_LIGHTS lights, so the lists never overflow
+    app->clusterLightsBuff = CreateBuffer(CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->clusterCounterBuff = CreateBuffer(sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+}
+
+void BuildClusters(App* app)
+{
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "Cluster Lights");
+
+    Program& program = app->programs[app->clusterLightsProgramIdx];
+    glUseProgram(program.handle);
+
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uView")), 1, GL_FALSE, glm::value_ptr(app->view));
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uInvProjection")), 1, GL_FALSE, glm::value_ptr(glm::inverse(app->projection)));
+    glUniform3ui(UniformLocation(program, UNIFORM("uClusterCount")), CLUSTER_COUNT_X, CLUSTER_COUNT_Y, CLUSTER_COUNT_Z);
+    glUniform1f(UniformLocation(program, UNIFORM("uNear")), app->zNear);
+    glUniform1f(UniformLocation(program, UNIFORM("uFar")), app->zFar);
+
+    const u32 zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterCounterBuff.handle);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->lightBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), app->clusterGridBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), app->clusterLightsBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), app->clusterCounterBuff.handle);
+
+    glDispatchCompute((CLUSTER_COUNT + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glPopDebugGroup();
+}
+
+void BindClusters(App* app, Program& program)
+{
+    // Slices are exponential in view depth: slice = log(depth) * scale + bias
+    const f32 logRange = logf(app->zFar / app->zNear);
+    const f32 sliceScale = CLUSTER_COUNT_Z / logRange;
+    const f32 sliceBias = -CLUSTER_COUNT_Z * logf(app->zNear) / logRange;
+    const vec2 tileSize = vec2((f32)app->renderSize.x / CLUSTER_COUNT_X, (f32)app->renderSize.y / CLUSTER_COUNT_Y);
+
+    glUniform3ui(UniformLocation(program, UNIFORM("uClusterCount")), CLUSTER_COUNT_X, CLUSTER_COUNT_Y, CLUSTER_COUNT_Z);
+    glUniform2f(UniformLocation(program, UNIFORM("uClusterTileSize")), tileSize.x, tileSize.y);
+    glUniform1f(UniformLocation(program, UNIFORM("uClusterScale")), sliceScale);
+    glUniform1f(UniformLocation(program, UNIFORM("uClusterBias")), sliceBias);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), app->clusterGridBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), app->clusterLightsBuff.handle);
+}
@@ -0,0 +1,24 @@
+//
+// clustered.h: Clustered Forward+ lighting. The view frustum is split into screen tiles
+// and exponential depth slices, a compute pass assigns the lights to the clusters they
+// touch and the forward shading pass only iterates over the lights of its cluster.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+#define CLUSTER_COUNT   (CLUSTER_COUNT_X * CLUSTER_COUNT_Y * CLUSTER_COUNT_Z)
+#define CLUSTER_MAX_LIGHTS 128 // MAX_CLUSTER_LIGHTS in Mode_ClusterLights
+
+void CreateClusterBuffers(App* app);
+
+// Rebuilds the light lists of every cluster for the current view and lights
+void BuildClusters(App* app);
+
+// Binds the cluster grid and light lists and sets the uniforms the shading program needs
+// to find the cluster of a fragment
+void BindClusters(App* app, Program& program);
@@ -0,0 +1,241 @@
+#include "cone_map.h"
+#include "buffer_management.h"
+#include "platform.h"
+#include "simd.h"
+#include <stb_image_write.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define CONE_MAX_RATIO 1.0f
+
+// Depth of the padding texels, below every texel so they never limit a cone
+#define CONE_PADDING_DEPTH 2.0f
+
+struct ConeMapInput
+{
+    std::vector<f32> depths;    // rows of stride texels, padded to the SIMD width
+    std::vector<f32> rowMin;    // shallowest depth of each row
+    std::vector<f32> u;         // texture coordinate of each column
+    ivec2            size;
+    u32              stride;
+};
+
+// Smallest squared cone ratio (distance^2 / depth difference^2) between the apex (u0, d0) and the
+// shallower texels of a row at squared vertical distance dy2, starting from best2
+#if SIMD_WIDTH == 8
+
+static f32 RowMinRatio2(const ConeMapInput& input, const f32* row, f32 u0, f32 d0, f32 dy2, f32 best2)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 apexU = _mm256_set1_ps(u0);
+    const __m256 apexDepth = _mm256_set1_ps(d0);
+    const __m256 rowDistance2 = _mm256_set1_ps(dy2);
+    __m256 best = _mm256_set1_ps(best2);
+
+    for (u32 x = 0; x < input.stride; x += 8)
+    {
+        const __m256 dd = _mm256_sub_ps(apexDepth, _mm256_loadu_ps(row + x));
+        const __m256 du = _mm256_sub_ps(_mm256_loadu_ps(&input.u[x]), apexU);
+        const __m256 distance2 = _mm256_add_ps(_mm256_mul_ps(du, du), rowDistance2);
+        const __m256 ratio2 = _mm256_div_ps(distance2, _mm256_mul_ps(dd, dd));
+        const __m256 shallower = _mm256_cmp_ps(dd, zero, _CMP_GT_OQ);
+        best = _mm256_min_ps(best, _mm256_blendv_ps(best, ratio2, shallower));
+    }
+
+    alignas(32) f32 lanes[8];
+    _mm256_store_ps(lanes, best);
+    for (u32 i = 1; i < 8; ++i)
+        lanes[0] = glm::min(lanes[0], lanes[i]);
+    return lanes[0];
+}
+
+#elif SIMD_WIDTH == 4
+
+static f32 RowMinRatio2(const ConeMapInput& input, const f32* row, f32 u0, f32 d0, f32 dy2, f32 best2)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 apexU = _mm_set1_ps(u0);
+    const __m128 apexDepth = _mm_set1_ps(d0);
+    const __m128 rowDistance2 = _mm_set1_ps(dy2);
+    __m128 best = _mm_set1_ps(best2);
+
+    for (u32 x = 0; x < input.stride; x += 4)
+    {
+        const __m128 dd = _mm_sub_ps(apexDepth, _mm_loadu_ps(row + x));
+        const __m128 du = _mm_sub_ps(_mm_loadu_ps(&input.u[x]), apexU);
+        const __m128 distance2 = _mm_add_ps(_mm_mul_ps(du, du), rowDistance2);
+        const __m128 ratio2 = _mm_div_ps(distance2, _mm_mul_ps(dd, dd));
+        const __m128 shallower = _mm_cmpgt_ps(dd, zero);
+        best = _mm_min_ps(best, _mm_or_ps(_mm_and_ps(shallower, ratio2), _mm_andnot_ps(shallower, best)));
+    }
+
+    best = _mm_min_ps(best, _mm_shuffle_ps(best, best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = _mm_min_ps(best, _mm_shuffle_ps(best, best, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(best);
+}
+
+#else
+
+static f32 RowMinRatio2(const ConeMapInput& input, const f32* row, f32 u0, f32 d0, f32 dy2, f32 best2)
+{
+    for (u32 x = 0; x < input.stride; ++x)
+    {
+        const f32 dd = d0 - row[x];
+        const f32 du = input.u[x] - u0;
+        if (dd > 0.0f)
+            best2 = glm::min(best2, (du * du + dy2) / (dd * dd));
+    }
+    return best2;
+}
+
+#endif
+
+static f32 TexelConeRatio(const ConeMapInput& input, i32 x, i32 y)
+{
+    const f32 d0 = input.depths[y * input.stride + x];
+    const f32 u0 = input.u[x];
+    f32 best2 = CONE_MAX_RATIO * CONE_MAX_RATIO;
+
+    // Rows from the nearest outwards: once the vertical distance alone makes every texel of the
+    // row a wider cone than the best one, it can be skipped
+    for (i32 dy = 0; dy < input.size.y; ++dy)
+    {
+        const f32 dv = (f32)dy / input.size.y;
+        const f32 dy2 = dv * dv;
+        if (dy2 >= best2)
+            break;
+
+        for (i32 side = 0; side < (dy == 0 ? 1 : 2); ++side)
+        {
+            const i32 rowY = side == 0 ? y + dy : y - dy;
+            if (rowY < 0 || rowY >= input.size.y)
+                continue;
+
+            const f32 maxDepthDifference = d0 - input.rowMin[rowY];
+            if (maxDepthDifference <= 0.0f || dy2 >= best2 * maxDepthDifference * maxDepthDifference)
+                continue;
+
+            best2 = RowMinRatio2(input, &input.depths[rowY * input.stride], u0, d0, dy2, best2);
+        }
+    }
+
+    return sqrtf(best2);
+}
+
+bool GenerateConeMap(const char* heightPath, std::vector<u8>& cone, ivec2& size)
+{
+    Image image = LoadImage(heightPath);
+    if (!image.pixels)
+        return false;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    ConeMapInput input = {};
+    input.size = image.size;
+    input.stride = Align(image.size.x, SIMD_WIDTH);
+    input.depths.assign(input.stride * image.size.y, CONE_PADDING_DEPTH);
+    input.rowMin.assign(image.size.y, 1.0f);
+    input.u.resize(input.stride);
+
+    for (u32 x = 0; x < input.stride; ++x)
+        input.u[x] = (f32)x / image.size.x;
+
+    const u8* pixels = (const u8*)image.pixels;
+    for (i32 y = 0; y < image.size.y; ++y)
+    {
+        for (i32 x = 0; x < image.size.x; ++x)
+        {
+            const f32 depth = pixels[y * image.stride + x * image.nchannels] / 255.0f;
+            input.depths[y * input.stride + x] = depth;
+            input.rowMin[y] = glm::min(input.rowMin[y], depth);
+        }
+    }
+
+    // Rows are interleaved between the threads, so each gets a share of the deep (slow) areas
+    cone.assign(image.size.x * image.size.y * 4, 0);
+    const u32 threadCount = glm::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (i32 y = t; y < image.size.y; y += threadCount)
+            {
+                for (i32 x = 0; x < image.size.x; ++x)
+                {
+                    // The shader squares it back, narrow cones get most of the precision
+                    const f32 ratio = TexelConeRatio(input, x, y) / CONE_MAX_RATIO;
+                    const u8* src = pixels + y * image.stride + x * image.nchannels;
+                    u8* dst = &cone[(y * image.size.x + x) * 4];
+                    dst[0] = src[0];
+                    dst[1] = (u8)glm::clamp(sqrtf(ratio) * 255.0f + 0.5f, 0.0f, 255.0f);
+                    dst[2] = image.nchannels > 2 ? src[2] : src[0];
+                    dst[3] = image.nchannels > 3 ? src[3] : 255;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    const f64 elapsed = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    ILOG("Cone map %s: %dx%d in %.1f ms on %u threads", heightPath, image.size.x, image.size.y, elapsed, threadCount);
+
+    size = image.size;
+    FreeImage(image);
+    return true;
+}
+
+u32 LoadConeMap(App* app, const char* heightPath)
+{
+    std::string coneName = heightPath;
+    coneName = coneName.substr(0, coneName.find_last_of('.'));
+    for (char& c : coneName)
+        if (c == '/' || c == '\\' || c == ':')
+            c = '_';
+    const std::string conePath = std::string(CONE_MAP_CACHE_DIRECTORY "/") + coneName + "_cone.png";
+
+    const u64 heightTimestamp = GetFileLastWriteTimestamp(heightPath);
+    const u64 coneTimestamp = GetFileLastWriteTimestamp(conePath.c_str());
+    if (coneTimestamp != 0 && coneTimestamp >= heightTimestamp)
+        return LoadTexture2D(app, conePath.c_str());
+
+    std::vector<u8> cone;
+    ivec2 size;
+    if (!GenerateConeMap(heightPath, cone, size))
+    {
+        // Without cones the relief has to be marched
+        app->coneStepMapping = false;
+        return LoadTexture2D(app, heightPath);
+    }
+
+#ifdef _WIN32
+    _mkdir(CONE_MAP_CACHE_DIRECTORY);
+#else
+    mkdir(CONE_MAP_CACHE_DIRECTORY, 0755);
+#endif
+
+    // LoadImage flips the rows, they are flipped back so the file matches the height map
+    stbi_flip_vertically_on_write(1);
+    const bool written = stbi_write_png(conePath.c_str(), size.x, size.y, 4, cone.data(), size.x * 4) != 0;
+    stbi_flip_vertically_on_write(0);
+
+    if (written)
+        return LoadTexture2D(app, conePath.c_str());
+
+    // Read-only install, the map is generated again on the next run
+    ELOG("Could not write cone map %s, using it without caching", conePath.c_str());
+
+    Image image = { cone.data(), size, 4, size.x * 4 };
+    Texture tex = {};
+    tex.handle = CreateTexture2DFromImage(image);
+    tex.filepath = conePath;
+    app->textures.push_back(tex);
+    return app->textures.size() - 1;
+}
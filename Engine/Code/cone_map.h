@@ -0,0 +1,26 @@
+//
+// cone_map.h: Cone step relief maps. For every texel of a depth map (0 at the surface, 1 at the
+// bottom) the cone ratio is the widest cone with its apex on the texel, opening towards the
+// surface, that holds no other texel. A ray inside that cone cannot hit the relief, so the shader
+// steps straight to the cone's edge instead of marching at a fixed rate. The maps are generated
+// once on the CPU (rows split over threads, texels of a row tested four or eight at a time) and
+// saved in CONE_MAP_CACHE_DIRECTORY, relative to the working directory like the assets.
+//
+
+#pragma once
+
+#include "engine.h"
+#include <vector>
+
+#define CONE_MAP_CACHE_DIRECTORY "TextureCache"
+
+// Cone map of the height map at heightPath as RGBA8 rows in the order LoadImage returns them: r
+// is the depth, g the square root of the cone ratio (in texture space units per unit of depth,
+// clamped to 1) and b, a are kept from the height map. Returns false if the height map could
+// not be read.
+bool GenerateConeMap(const char* heightPath, std::vector<u8>& cone, ivec2& size);
+
+// Texture index of the cone map of heightPath, cached as <path with '/' as '_'>_cone.png. It is
+// (re)generated when missing or older than the height map. If the cache cannot be written the
+// generated map is used directly, and the height map itself if generating it fails.
+u32 LoadConeMap(App* app, const char* heightPath);
@@ -0,0 +1,253 @@
+#include "culling.h"
+#include "buffer_management.h"
+#include "bvh.h"
+#include "simd.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#define CULL_BOUNDS_PADDING 8
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    // Rows of the matrix, glm stores it by columns
+    const glm::mat4 m = glm::transpose(viewProjection);
+
+    Frustum frustum = {};
+    frustum.planes[0] = m[3] + m[0]; // left
+    frustum.planes[1] = m[3] - m[0]; // right
+    frustum.planes[2] = m[3] + m[1]; // bottom
+    frustum.planes[3] = m[3] - m[1]; // top
+    frustum.planes[4] = m[3] + m[2]; // near
+    frustum.planes[5] = m[3] - m[2]; // far
+
+    for (u32 i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+
+    return frustum;
+}
+
+void ResizeCullBounds(CullBounds& bounds, u32 count)
+{
+    const u32 padded = Align(count, CULL_BOUNDS_PADDING);
+    bounds.centerX.resize(padded);
+    bounds.centerY.resize(padded);
+    bounds.centerZ.resize(padded);
+    bounds.extentX.resize(padded);
+    bounds.extentY.resize(padded);
+    bounds.extentZ.resize(padded);
+    bounds.count = count;
+}
+
+void SetCullBounds(CullBounds& bounds, u32 index, const vec3& center, const vec3& extent)
+{
+    bounds.centerX[index] = center.x;
+    bounds.centerY[index] = center.y;
+    bounds.centerZ[index] = center.z;
+    bounds.extentX[index] = extent.x;
+    bounds.extentY[index] = extent.y;
+    bounds.extentZ[index] = extent.z;
+}
+
+void CullBoundsScalar(const Frustum& frustum, const CullBounds& bounds, u8* visible)
+{
+    for (u32 i = 0; i < bounds.count; ++i)
+    {
+        u8 inside = 1;
+        for (u32 p = 0; p < 6 && inside; ++p)
+        {
+            // Distance of the box center plus the box projected radius along the plane normal
+            const vec4& plane = frustum.planes[p];
+            const f32 distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+            const f32 radius = fabsf(plane.x) * bounds.extentX[i] + fabsf(plane.y) * bounds.extentY[i] + fabsf(plane.z) * bounds.extentZ[i];
+            inside = distance + radius >= 0.0f;
+        }
+        visible[i] = inside;
+    }
+}
+
+#if SIMD_WIDTH == 8
+
+void CullBoundsSIMD(const Frustum& frustum, const CullBounds& bounds, u8* visible)
+{
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (u32 i = 0; i < bounds.count; i += 8)
+    {
+        const __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        const __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        const __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        const __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        const __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        const __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const vec4& plane = frustum.planes[p];
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_set1_ps(plane.w));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.y), cy));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(plane.z), cz));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), ex));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.y)), ey));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.z)), ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+        }
+
+        const int mask = _mm256_movemask_ps(inside);
+        for (u32 j = 0; j < 8; ++j)
+            visible[i + j] = (mask >> j) & 1;
+    }
+}
+
+#elif SIMD_WIDTH == 4
+
+void CullBoundsSIMD(const Frustum& frustum, const CullBounds& bounds, u8* visible)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    for (u32 i = 0; i < bounds.count; i += 4)
+    {
+        const __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        const __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        const __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        const __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        const __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        const __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const vec4& plane = frustum.planes[p];
+            __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_set1_ps(plane.w));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.y), cy));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(plane.z), cz));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+        }
+
+        const int mask = _mm_movemask_ps(inside);
+        visible[i + 0] = (mask >> 0) & 1;
+        visible[i + 1] = (mask >> 1) & 1;
+        visible[i + 2] = (mask >> 2) & 1;
+        visible[i + 3] = (mask >> 3) & 1;
+    }
+}
+
+#else
+
+void CullBoundsSIMD(const Frustum& frustum, const CullBounds& bounds, u8* visible)
+{
+    CullBoundsScalar(frustum, bounds, visible);
+}
+
+#endif
+
+void CullDrawList(App* app)
+{
+    const u32 itemCount = app->drawList.size();
+    ResizeCullBounds(app->drawBounds, itemCount);
+    app->drawVisible.resize(Align(itemCount, CULL_BOUNDS_PADDING));
+
+    if (!app->frustumCulling)
+    {
+        std::fill(app->drawVisible.begin(), app->drawVisible.end(), 1);
+        app->visibleDrawCount = itemCount;
+        return;
+    }
+
+    const Frustum frustum = ExtractFrustum(app->projection * app->view);
+
+    // Coarse pass over the scene BVH, rejects whole groups of entities at once
+    std::vector<u32>& visibleEntities = app->visibleEntities;
+    visibleEntities.clear();
+    QueryFrustum(app->sceneBVH, frustum, visibleEntities);
+
+    app->entityVisible.assign(app->entities.size(), 0);
+    for (u32 i = 0; i < visibleEntities.size(); ++i)
+        app->entityVisible[visibleEntities[i]] = 1;
+
+    // Fine pass over the submeshes of the visible entities only
+    std::vector<u32>& candidates = app->cullCandidates;
+    candidates.clear();
+    for (u32 i = 0; i < itemCount; ++i)
+    {
+        const DrawItem& item = app->drawList[i];
+        app->drawVisible[i] = 0;
+        if (!app->entityVisible[item.entityIdx])
+            continue;
+
+        const Submesh& submesh = app->meshes[item.meshIdx].submeshes[item.submeshIdx];
+        const glm::mat4& world = app->entities[item.entityIdx].worldMatrix;
+
+        // World space AABB enclosing the transformed local box
+        const vec3 center = vec3(world * vec4((submesh.aabbMin + submesh.aabbMax) * 0.5f, 1.0f));
+        const vec3 extent = (submesh.aabbMax - submesh.aabbMin) * 0.5f;
+        const glm::mat3 absWorld = glm::mat3(glm::abs(vec3(world[0])), glm::abs(vec3(world[1])), glm::abs(vec3(world[2])));
+        SetCullBounds(app->drawBounds, candidates.size(), center, absWorld * extent);
+        candidates.push_back(i);
+    }
+
+    app->drawBounds.count = candidates.size();
+    std::vector<u8>& candidateVisible = app->candidateVisible;
+    candidateVisible.resize(Align(candidates.size(), CULL_BOUNDS_PADDING));
+    CullBoundsSIMD(frustum, app->drawBounds, candidateVisible.data());
+
+    app->visibleDrawCount = 0;
+    for (u32 i = 0; i < candidates.size(); ++i)
+    {
+        app->drawVisible[candidates[i]] = candidateVisible[i];
+        app->visibleDrawCount += candidateVisible[i];
+    }
+}
+
+void RunCullingBenchmark()
+{
+    const u32 counts[] = { 10000, 100000, 1000000 };
+    const u32 iterations = 20;
+
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+    const glm::mat4 view = glm::lookAt(vec3(0.0f, 5.0f, 20.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum = ExtractFrustum(projection * view);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<f32> size(0.1f, 5.0f);
+
+    for (u32 c = 0; c < ARRAY_COUNT(counts); ++c)
+    {
+        CullBounds bounds = {};
+        ResizeCullBounds(bounds, counts[c]);
+        for (u32 i = 0; i < counts[c]; ++i)
+            SetCullBounds(bounds, i, vec3(position(rng), position(rng), position(rng)), vec3(size(rng), size(rng), size(rng)));
+
+        std::vector<u8> visibleScalar(Align(counts[c], CULL_BOUNDS_PADDING));
+        std::vector<u8> visibleSIMD(visibleScalar.size());
+
+        // Best of several runs, to keep the numbers stable
+        f64 bestScalar = 1e9, bestSIMD = 1e9;
+        for (u32 it = 0; it < iterations; ++it)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            CullBoundsScalar(frustum, bounds, visibleScalar.data());
+            auto middle = std::chrono::high_resolution_clock::now();
+            CullBoundsSIMD(frustum, bounds, visibleSIMD.data());
+            auto end = std::chrono::high_resolution_clock::now();
+
+            bestScalar = glm::min(bestScalar, std::chrono::duration<f64, std::milli>(middle - start).count());
+            bestSIMD = glm::min(bestSIMD, std::chrono::duration<f64, std::milli>(end - middle).count());
+        }
+
+        u32 visibleCount = 0, mismatches = 0;
+        for (u32 i = 0; i < counts[c]; ++i)
+        {
+            visibleCount += visibleSIMD[i];
+            mismatches += visibleScalar[i] != visibleSIMD[i];
+        }
+
+        ILOG("Culling %7u boxes: scalar %8.3f ms, %u-wide %8.3f ms (x%.1f), %u visible, %u mismatches",
+             counts[c], bestScalar, SIMD_WIDTH, bestSIMD, bestScalar / bestSIMD, visibleCount, mismatches);
+    }
+}
@@ -0,0 +1,34 @@
+//
+// culling.h: Frustum culling of world space bounding boxes. Boxes are tested four
+// (SSE) or eight (AVX) at a time, with a scalar fallback for other targets.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Planes point inwards: a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+    vec4 planes[6];
+};
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+void ResizeCullBounds(CullBounds& bounds, u32 count);
+
+void SetCullBounds(CullBounds& bounds, u32 index, const vec3& center, const vec3& extent);
+
+// Writes 1 to visible[i] for every box intersecting the frustum and 0 otherwise.
+// visible must hold at least bounds.count entries rounded up to a multiple of 8.
+void CullBoundsScalar(const Frustum& frustum, const CullBounds& bounds, u8* visible);
+
+void CullBoundsSIMD(const Frustum& frustum, const CullBounds& bounds, u8* visible);
+
+// Queries the scene BVH for the entities in the view frustum, then tests the world
+// bounds of their submeshes and fills app->drawVisible, which BuildDrawBatches uses
+// to skip culled items
+void CullDrawList(App* app);
+
+// Times the scalar and SIMD paths over 10k, 100k and 1M random boxes and logs the results
+void RunCullingBenchmark();
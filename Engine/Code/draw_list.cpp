@@ -0,0 +1,218 @@
+#include "draw_list.h"
+#include "buffer_management.h"
+#include "bvh.h"
+#include <algorithm>
+
+void BuildDrawList(App* app)
+{
+    app->drawList.clear();
+
+    // Every (mesh, submesh) pair gets a small id so it fits in the geometry bits of the key
+    std::unordered_map<u64, u32> geometryIds;
+
+    // One instance and one indirect command per entity submesh, the instance, command and object
+    // buffers only hold MAX_INSTANCES of them. Whatever does not fit is left out of the frame.
+    u32 skippedItems = 0;
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        const Entity& entity = app->entities[i];
+        const Model& model = app->models[entity.modelIndex];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        {
+            if (i >= MAX_INSTANCES || app->drawList.size() >= MAX_INSTANCES)
+            {
+                skippedItems++;
+                continue;
+            }
+
+            const u64 geometryKey = ((u64)model.meshIdx << 32) | j;
+            auto it = geometryIds.find(geometryKey);
+            if (it == geometryIds.end())
+                it = geometryIds.insert({ geometryKey, (u32)geometryIds.size() }).first;
+
+            DrawItem item = {};
+            item.entityIdx = i;
+            item.meshIdx = model.meshIdx;
+            item.submeshIdx = j;
+            item.materialIdx = model.materialIdx[j];
+            item.features = app->materials[item.materialIdx].features;
+            item.sortKey = ((u64)(item.features & 0xff) << DRAW_KEY_VARIANT_SHIFT) |
+                           ((u64)(it->second & 0xffff) << DRAW_KEY_GEOMETRY_SHIFT) |
+                           ((u64)(item.materialIdx & 0xffff) << DRAW_KEY_MATERIAL_SHIFT);
+            app->drawList.push_back(item);
+        }
+    }
+
+    if (skippedItems > 0)
+        ELOG("Draw list is limited to %u instances, %u submeshes are not drawn", MAX_INSTANCES, skippedItems);
+
+    app->drawListDirty = false;
+    app->drawListEntityCount = app->entities.size();
+}
+
+void UpdateDrawList(App* app)
+{
+    // Also catches entities added or removed without setting the flag
+    if (app->drawListDirty || app->drawListEntityCount != app->entities.size())
+        BuildDrawList(app);
+
+    // View space distance of every entity, quantized so closer draws come first within the same state
+    std::vector<u64> entityDepths(app->entities.size());
+    for (u32 i = 0; i < app->entities.size(); ++i)
+    {
+        const vec4 viewPosition = app->view * app->entities[i].worldMatrix[3];
+        const float depth = glm::clamp(-viewPosition.z / app->zFar, 0.0f, 1.0f);
+        entityDepths[i] = (u64)(depth * DRAW_KEY_DEPTH_MASK);
+    }
+
+    for (u32 i = 0; i < app->drawList.size(); ++i)
+    {
+        DrawItem& item = app->drawList[i];
+        item.sortKey = (item.sortKey & ~DRAW_KEY_DEPTH_MASK) | entityDepths[item.entityIdx];
+    }
+
+    // State changes first, then front to back
+    std::sort(app->drawList.begin(), app->drawList.end(),
+              [](const DrawItem& a, const DrawItem& b) { return a.sortKey < b.sortKey; });
+}
+
+void UpdateObjectBuffer(App* app)
+{
+    // Entities past the buffer are never drawn, BuildDrawList leaves them out and reports it
+    const u32 objectCount = glm::min((u32)app->entities.size(), (u32)MAX_INSTANCES);
+    for (u32 i = objectCount; i < app->entities.size(); ++i)
+        app->entities[i].dirty = false;
+
+    // Consecutive dirty entities are uploaded together, clean ones are never touched
+    std::vector<ObjectData> range;
+    u32 rangeStart = 0;
+
+    for (u32 i = 0; i <= objectCount; ++i)
+    {
+        if (i < objectCount && app->entities[i].dirty)
+        {
+            Entity& entity = app->entities[i];
+            if (range.empty())
+                rangeStart = i;
+
+            ObjectData object = {};
+            object.model = entity.worldMatrix;
+            object.normalMatrix = glm::transpose(glm::inverse(entity.worldMatrix));
+
+            vec3 aabbMin, aabbMax;
+            EntityWorldBounds(app, i, aabbMin, aabbMax);
+            object.aabbMin = vec4(aabbMin, 0.0f);
+            object.aabbMax = vec4(aabbMax, 0.0f);
+            range.push_back(object);
+            entity.dirty = false;
+        }
+        else if (!range.empty())
+        {
+            UpdateData(app->objectBuff, rangeStart * sizeof(ObjectData), range.data(), range.size() * sizeof(ObjectData));
+            range.clear();
+        }
+    }
+}
+
+void BuildDrawBatches(App* app)
+{
+    app->drawBatches.clear();
+    app->drawBuckets.clear();
+
+    // Instances are tightly packed so the base instance of a batch is its index in the region
+    AlignHead(app->instanceBuff, app->storageBlockAlignment);
+    app->InstanceParamsOffset = app->instanceBuff.head;
+
+    const u64 batchMask = ~DRAW_KEY_DEPTH_MASK;
+    // Material params are fetched per instance, so buckets only split on the variant and, unless
+    // the textures are bindless too, where the bound textures change
+    const u64 bucketMask = ~((1ull << DRAW_KEY_VARIANT_SHIFT) - 1);
+    auto sameTextures = [app](const DrawItem& a, const DrawItem& b)
+    {
+        const Material& ma = app->materials[a.materialIdx];
+        const Material& mb = app->materials[b.materialIdx];
+        return ma.albedoTextureIdx == mb.albedoTextureIdx && ma.normalsTextureIdx == mb.normalsTextureIdx &&
+               ma.bumpTextureIdx == mb.bumpTextureIdx;
+    };
+    u32 instanceCount = 0;
+
+    for (u32 i = 0; i < app->drawList.size(); ++i)
+    {
+        const DrawItem& item = app->drawList[i];
+        if (!app->drawVisible[i])
+            continue;
+
+        // Items sharing variant, material and geometry are adjacent after sorting
+        const bool sameBatch = !app->drawBatches.empty() &&
+            (app->drawList[app->drawBatches.back().firstItem].sortKey & batchMask) == (item.sortKey & batchMask);
+
+        if (!sameBatch)
+        {
+            DrawBatch batch = {};
+            batch.firstItem = i;
+            batch.baseInstance = instanceCount;
+            app->drawBatches.push_back(batch);
+        }
+
+        InstanceData instance = {};
+        instance.objectIdx = item.entityIdx;
+        instance.materialIdx = item.materialIdx;
+        instance.batchIdx = app->drawBatches.size() - 1;
+        PushAlignedData(app->instanceBuff, &instance, sizeof(instance), sizeof(u32));
+        app->drawBatches.back().instanceCount++;
+        instanceCount++;
+    }
+
+    app->InstanceParamsSize = app->instanceBuff.head - app->InstanceParamsOffset;
+    app->InstanceCount = instanceCount;
+
+    // The occlusion culling pass fills in the instance counts, and reads the commands as a storage buffer
+    const bool occlusion = app->occlusionCulling;
+    AlignHead(app->indirectBuff, app->storageBlockAlignment);
+    app->CommandsOffset = app->indirectBuff.head;
+
+    std::vector<DrawElementsIndirectCommand>& commands = app->drawCommands;
+    commands.clear();
+
+    for (u32 i = 0; i < app->drawBatches.size(); ++i)
+    {
+        const DrawBatch& batch = app->drawBatches[i];
+        const DrawItem& item = app->drawList[batch.firstItem];
+        const Submesh& submesh = app->meshes[item.meshIdx].submeshes[item.submeshIdx];
+
+        const DrawItem* bucketItem = app->drawBuckets.empty() ? nullptr : &app->drawList[app->drawBatches[app->drawBuckets.back().firstBatch].firstItem];
+        const bool sameBucket = bucketItem && (bucketItem->sortKey & bucketMask) == (item.sortKey & bucketMask) &&
+            (app->bindlessTextures || sameTextures(*bucketItem, item));
+
+        if (!sameBucket)
+        {
+            DrawBucket bucket = {};
+            bucket.firstBatch = i;
+            bucket.commandOffset = app->indirectBuff.head - app->CommandsOffset;
+            app->drawBuckets.push_back(bucket);
+        }
+
+        DrawElementsIndirectCommand command = {};
+        command.count = submesh.indices.size();
+        command.instanceCount = occlusion ? 0 : batch.instanceCount;
+        command.firstIndex = submesh.firstIndex;
+        command.baseVertex = submesh.baseVertex;
+        command.baseInstance = batch.baseInstance;
+        PushAlignedData(app->indirectBuff, &command, sizeof(command), sizeof(u32));
+        commands.push_back(command);
+        app->drawBuckets.back().batchCount++;
+    }
+
+    app->CommandsSize = app->indirectBuff.head - app->CommandsOffset;
+
+    // Second phase commands, same layout so bucket offsets apply to both copies. They are
+    // pushed again rather than copied since the mapping may be write only.
+    if (occlusion)
+    {
+        AlignHead(app->indirectBuff, app->storageBlockAlignment);
+        app->OcclusionCommandsOffset = app->indirectBuff.head;
+        PushData(app->indirectBuff, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "engine.h"
+
+#define DRAW_KEY_VARIANT_SHIFT  56
+#define DRAW_KEY_MATERIAL_SHIFT 40
+#define DRAW_KEY_GEOMETRY_SHIFT 24
+#define DRAW_KEY_DEPTH_BITS     24
+#define DRAW_KEY_DEPTH_MASK     ((1ull << DRAW_KEY_DEPTH_BITS) - 1)
+
+void BuildDrawList(App* app);
+
+// Rebuilds the list if it is dirty, then refreshes the depth bits and sorts it
+void UpdateDrawList(App* app);
+
+// Re-uploads the object data (model and normal matrices, world bounds) of the entities marked dirty
+void UpdateObjectBuffer(App* app);
+
+// Groups the visible items of the sorted list into instanced batches and batches into buckets. Pushes the
+// object and material indices of every instance into the instance buffer and one indirect command per batch into the
+// indirect buffer, both must be mapped.
+void BuildDrawBatches(App* app);
@@ -8,125 +8,312 @@
 #include "engine.h"
 #include "assimp.h"
 #include "buffer_management.h"
+#include "gl_extensions.h"
+#include "draw_list.h"
+#include "culling.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "clustered.h"
+#include "lights.h"
+#include "framegraph.h"
+#include "render_targets.h"
+#include "bloom.h"
+#include "blur.h"
+#include "cone_map.h"
+#include "file_watcher.h"
+#include "program_cache.h"
+#include "program_reload.h"
 #include <imgui.h>
+#include <algorithm>
+#include <chrono>
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/quaternion.hpp>
 
-#define BINDING(b) b
+#define RESIZE_STABLE_FRAMES 8 // the render targets follow displaySize once it stopped changing for this long
 
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+GLuint SubmitProgramFromSource(String programSource, const char* shaderName, const char* defines, bool compute, GLuint shaders[2])
 {
-    GLchar  infoLogBuffer[1024] = {};
-    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-    GLsizei infoLogSize;
-    GLint   success;
-
     char versionString[] = "#version 430\n";
     char shaderNameDefine[128];
     sprintf(shaderNameDefine, "#define %s\n", shaderName);
-    char vertexShaderDefine[] = "#define VERTEX\n";
-    char fragmentShaderDefine[] = "#define FRAGMENT\n";
-
-    const GLchar* vertexShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        vertexShaderDefine,
-        programSource.str
-    };
-    const GLint vertexShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(vertexShaderDefine),
-        (GLint) programSource.len
-    };
-    const GLchar* fragmentShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        fragmentShaderDefine,
-        programSource.str
-    };
-    const GLint fragmentShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(fragmentShaderDefine),
-        (GLint) programSource.len
-    };
 
-    GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-    glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    const GLenum stages[] = { compute ? (GLenum)GL_COMPUTE_SHADER : (GLenum)GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const char* stageDefines[] = { compute ? "#define COMPUTE\n" : "#define VERTEX\n", "#define FRAGMENT\n" };
+    const u32 stageCount = compute ? 1 : 2;
+
+    GLuint programHandle = glCreateProgram();
+    shaders[0] = shaders[1] = 0;
+
+    for (u32 i = 0; i < stageCount; ++i)
     {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        const GLchar* shaderSource[] = {
+            versionString,
+            shaderNameDefine,
+            defines,
+            stageDefines[i],
+            programSource.str
+        };
+        const GLint shaderLengths[] = {
+            (GLint) strlen(versionString),
+            (GLint) strlen(shaderNameDefine),
+            (GLint) strlen(defines),
+            (GLint) strlen(stageDefines[i]),
+            (GLint) programSource.len
+        };
+
+        shaders[i] = glCreateShader(stages[i]);
+        glShaderSource(shaders[i], ARRAY_COUNT(shaderSource), shaderSource, shaderLengths);
+        glCompileShader(shaders[i]);
+        glAttachShader(programHandle, shaders[i]);
     }
 
-    GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-    glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(programHandle);
+
+    return programHandle;
+}
+
+bool FinishProgramFromSource(GLuint programHandle, GLuint shaders[2], const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    for (u32 i = 0; i < 2; ++i)
     {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        if (shaders[i] == 0)
+            continue;
+
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            GLint type;
+            glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+            const char* stageName = type == GL_VERTEX_SHADER ? "vertex" : type == GL_FRAGMENT_SHADER ? "fragment" : "compute";
+            glGetShaderInfoLog(shaders[i], infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", stageName, shaderName, infoLogBuffer);
+        }
     }
 
-    GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
-    glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-    if (!success)
+    GLint linked;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &linked);
+    if (!linked)
     {
         glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
         ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
     }
 
-    glUseProgram(0);
+    for (u32 i = 0; i < 2; ++i)
+    {
+        if (shaders[i] == 0)
+            continue;
+        glDetachShader(programHandle, shaders[i]);
+        glDeleteShader(shaders[i]);
+        shaders[i] = 0;
+    }
 
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
+    return linked == GL_TRUE;
+}
 
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, const char* defines, bool compute)
+{
+    GLuint shaders[2];
+    GLuint programHandle = SubmitProgramFromSource(programSource, shaderName, defines, compute, shaders);
+    FinishProgramFromSource(programHandle, shaders, shaderName);
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+void ReflectProgram(Program& program)
 {
-    String programSource = ReadTextFile(filepath);
+    program.vertexInputLayout.attributes.clear();
+    program.uniforms.clear();
 
-    Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
-    GLint attributeCount = 0;
+    // Name buffers fit the longest name, so none is truncated
+    GLint attributeCount = 0, attributeNameSize = 0;
     glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &attributeNameSize);
+    std::vector<GLchar> name(glm::max(attributeNameSize, 1));
 
     for (int i = 0; i < attributeCount; ++i)
     {
         GLint size;
         GLenum type;
-        const GLsizei bufSize = 16;
-        GLchar name[bufSize];
         GLsizei length;
 
-        glGetActiveAttrib(program.handle, (GLuint)i, bufSize, &length, &size, &type, name);
-        u8 attributeLocation = glGetAttribLocation(program.handle, name);
+        glGetActiveAttrib(program.handle, (GLuint)i, name.size(), &length, &size, &type, name.data());
+        ASSERT(length < (GLsizei)name.size(), "Truncated attribute name");
+        u8 attributeLocation = glGetAttribLocation(program.handle, name.data());
         program.vertexInputLayout.attributes.push_back({attributeLocation, (u8)size});
     }
 
+    GLint uniformCount = 0, uniformNameSize = 0;
+    glGetProgramiv(program.handle, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(program.handle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformNameSize);
+    name.resize(glm::max(uniformNameSize, 1));
+    std::unordered_map<u32, std::string> names;
+
+    for (int i = 0; i < uniformCount; ++i)
+    {
+        GLint size;
+        GLenum type;
+        GLsizei length;
+
+        glGetActiveUniform(program.handle, (GLuint)i, name.size(), &length, &size, &type, name.data());
+        ASSERT(length < (GLsizei)name.size(), "Truncated uniform name");
+        GLint location = glGetUniformLocation(program.handle, name.data());
+        if (location == -1)
+            continue; // Members of uniform blocks have no location
+
+        // Arrays are reported as "name[0]", register them by their plain name
+        if (length > 3 && strcmp(name.data() + length - 3, "[0]") == 0)
+            name[length - 3] = '\0';
+
+        // Two names with the same hash would silently share a location
+        const u32 nameHash = HashString(name.data());
+        auto it = names.insert({ nameHash, name.data() });
+        if (!it.second)
+            ELOG("Program %s: uniforms %s and %s have the same hash", program.programName.c_str(), it.first->second.c_str(), name.data());
+        ASSERT(it.second, "Uniform name hash collision");
+
+        program.uniforms.push_back({ nameHash, location, type, size });
+    }
+
+    std::sort(program.uniforms.begin(), program.uniforms.end(),
+              [](const ProgramUniform& a, const ProgramUniform& b) { return a.nameHash < b.nameHash; });
+}
+
+GLint UniformLocation(const Program& program, u32 nameHash)
+{
+    // The hash is a compile time constant (UNIFORM), the lookup a binary search over the table built at link time
+    auto it = std::lower_bound(program.uniforms.begin(), program.uniforms.end(), nameHash,
+                               [](const ProgramUniform& uniform, u32 hash) { return uniform.nameHash < hash; });
+    return it != program.uniforms.end() && it->nameHash == nameHash ? it->location : -1;
+}
+
+// Loads the program from the binary cache, or compiles it and adds it to the cache
+static GLuint BuildProgram(App* app, const ProgramSource& programSource, const char* programName, const char* defines, bool compute)
+{
+    const u64 key = ProgramCacheKey(app, programSource, programName, defines, compute);
+    GLuint handle = LoadCachedProgram(app, key);
+    if (handle != 0)
+    {
+        app->programCacheHits++;
+        return handle;
+    }
+
+    app->programCacheMisses++;
+    handle = CreateProgramFromSource(ProgramSourceText(programSource), programName, defines, compute);
+    StoreCachedProgram(app, key, handle);
+    return handle;
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines)
+{
+    const ProgramSource programSource = PreprocessProgramSource(ReadTextFile(filepath));
+
+    Program program = {};
+    program.handle = BuildProgram(app, programSource, programName, defines, false);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.fileWatch = WatchFile(filepath);
+    ReflectProgram(program);
+
     app->programs.push_back(program);
 
 
     return app->programs.size() - 1;
 }
 
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName, const char* defines)
+{
+    const ProgramSource programSource = PreprocessProgramSource(ReadTextFile(filepath));
+
+    Program program = {};
+    program.handle = BuildProgram(app, programSource, programName, defines, true);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.compute = true;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.fileWatch = WatchFile(filepath);
+    ReflectProgram(program);
+
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+// In ProgramFeature bit order
+static const char* ProgramFeatureDefines[PROGRAM_FEATURE_COUNT] =
+{
+    "#define NORMAL_MAP\n",
+    "#define RELIEF_MAP\n",
+    "#define CONE_STEP_MAPPING\n",
+};
+
+u32 LoadProgramPermutations(App* app, const char* filepath, const char* programName, const char* defines)
+{
+    ProgramPermutations permutations = {};
+    permutations.filepath = filepath;
+    permutations.programName = programName;
+    permutations.defines = defines;
+    for (u32& programIdx : permutations.programIdx)
+        programIdx = UINT32_MAX;
+
+    app->programPermutations.push_back(permutations);
+    const u32 permutationsIdx = app->programPermutations.size() - 1;
+
+    // Every pass draws some material without features, and its link errors show at startup
+    GetProgramVariant(app, permutationsIdx, 0);
+    return permutationsIdx;
+}
+
+u32 GetProgramVariant(App* app, u32 permutationsIdx, u32 features)
+{
+    ProgramPermutations& permutations = app->programPermutations[permutationsIdx];
+    u32& programIdx = permutations.programIdx[features];
+    if (programIdx == UINT32_MAX)
+    {
+        std::string defines = permutations.defines;
+        for (u32 i = 0; i < PROGRAM_FEATURE_COUNT; ++i)
+            if (features & (1 << i))
+                defines += ProgramFeatureDefines[i];
+
+        programIdx = LoadProgram(app, permutations.filepath.c_str(), permutations.programName.c_str(), defines.c_str());
+    }
+    return programIdx;
+}
+
+void LoadMaterialProgramVariants(App* app, u32 materialFeatures)
+{
+    // The GUI turns normal and relief mapping off and switches relief to cone stepping, so any
+    // subset of the features can be drawn, cone stepping only along with relief
+    u32 reachable = materialFeatures;
+    if (reachable & ProgramFeature_ReliefMap)
+        reachable |= ProgramFeature_ConeStep;
+
+    for (u32 permutationsIdx = 0; permutationsIdx < app->programPermutations.size(); ++permutationsIdx)
+    {
+        // Always drawn with the variant without features
+        if (permutationsIdx == app->DepthPrepassIdx)
+            continue;
+
+        for (u32 features = reachable;; features = (features - 1) & reachable)
+        {
+            if (!(features & ProgramFeature_ConeStep) || (features & ProgramFeature_ReliefMap))
+                GetProgramVariant(app, permutationsIdx, features);
+            if (features == 0)
+                break;
+        }
+    }
+}
+
 Image LoadImage(const char* filename)
 {
     Image img = {};
@@ -202,58 +389,6 @@ u32 LoadTexture2D(App* app, const char* filepath)
     }
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
-{
-    Submesh& submesh = mesh.submeshes[submeshIndex];
-
-    // Try finding a vao for this submesh/program
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
-    {
-        if (submesh.vaos[i].programHandle == program.handle)
-            return submesh.vaos[i].handle;
-    }
-
-    // Create a new vao for 
-    GLuint vaoHandle = 0;
-    glGenVertexArrays(1, &vaoHandle);
-    glBindVertexArray(vaoHandle);
-
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-
-    // We have to link all vertex inputs attributes to attributes in the vertex buffer
-    for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
-    {
-        bool attributeWasLinked = false;
-
-        for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
-        {
-            if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
-            {
-                const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset; // attribute offset + vertex offset
-                const u32 stride = submesh.vertexBufferLayout.stride;
-                glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-                glEnableVertexAttribArray(index);
-
-                attributeWasLinked = true;
-                break;
-            }
-        }
-
-        assert(attributeWasLinked); // The submesh should provide an attribute for each vertex inputs
-    }
-
-    glBindVertexArray(0);
-
-    // Store it in the list of vaos for this submesh
-    Vao vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
-
-    return vaoHandle;
-}
-
 void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
 {
     if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
@@ -317,22 +452,34 @@ glm::mat4 TransformPositionRotationScale(const vec3& pos, const vec3& rot, const
 }
 
 //Framebuffer
-void BufferTextureInit(GLuint& handle, ivec2 size)
+void BufferTextureInit(App* app, GLuint& handle, GLenum internalFormat)
 {
-    glGenTextures(1, &handle);
+    // The previous target goes back to the pool, which deletes it if the new size doesn't reuse it
+    if (handle != 0)
+        ReleaseRenderTarget(app->renderTargets, handle);
+
+    handle = AcquireRenderTarget(app->renderTargets, app->renderSize, internalFormat);
+}
+
+void BufferBloomTextureInit(App* app, GLuint& handle)
+{
+    if (handle != 0)
+        ReleaseRenderTarget(app->renderTargets, handle);
+
+    handle = AcquireRenderTarget(app->renderTargets, app->renderSize / 2, GL_RGBA16F, app->bloomChainLevels);
     glBindTexture(GL_TEXTURE_2D, handle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // upsampled to the render size
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, app->bloomChainLevels - 1);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void BufferBloomInit(App* app, GLuint& handle, int level) {
 
     //Bloom FrameBuffer
+    if (handle != 0)
+        glDeleteFramebuffers(1, &handle);
     glGenFramebuffers(1, &handle);
     glBindFramebuffer(GL_FRAMEBUFFER, handle);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->rtBright, level);
@@ -361,102 +508,56 @@ void BufferBloomInit(App* app, GLuint& handle, int level) {
 
 void FrameBufferObject(App* app)
 {
-    //color Texture
-    BufferTextureInit(app->colorTexHandle, app->displaySize);
-    BufferTextureInit(app->normalTexhandle, app->displaySize);
-    BufferTextureInit(app->albedoTexhandle, app->displaySize);
-    BufferTextureInit(app->depthTexhandle, app->displaySize);
-    BufferTextureInit(app->positionTexhandle, app->displaySize);
+    //color Texture. The G-buffer normals and albedo are transient textures of the frame graph,
+    //positions are reconstructed from the depth attachment
+    BufferTextureInit(app, app->colorTexHandle, GL_RGBA8);
+    BufferTextureInit(app, app->debugTexHandle, GL_RGBA8);
 
     //depth Texture
-    glGenTextures(1, &app->depthAttachmentHandle);
-    glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    //framebuffer
-    glGenFramebuffers(1, &app->framebufferHandle);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->colorTexHandle, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, app->normalTexhandle, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, app->albedoTexhandle, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, app->depthTexhandle, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, app->positionTexhandle, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->depthAttachmentHandle, 0);
+    BufferTextureInit(app, app->depthAttachmentHandle, GL_DEPTH_COMPONENT24);
 
-    //check errors
-    GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-    {
-        switch (framebufferStatus)
-        {
-            case GL_FRAMEBUFFER_UNDEFINED:                                  ELOG("GL_FRAMEBUFFER_UNDEFINED"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:                      ELOG("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:              ELOG("GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"); break;
-            case GL_FRAMEBUFFER_UNSUPPORTED:                                ELOG("GL_FRAMEBUFFER_UNSUPPORTED"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"); break;
-            case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:                   ELOG("GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"); break;
-            default: ELOG("Unknown framebuffer status error");
-        }
-    }
+    //the frame graph builds the framebuffers over these textures when the passes need them
+    FGReleaseFramebuffers(app->frameGraph);
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+u32 BloomLevelCount(const App* app)
+{
+    const ivec2 size = glm::max(app->renderSize / 2, ivec2(1));
+    const u32 maxLevels = 1 + (u32)floorf(log2f((f32)glm::min(size.x, size.y)));
+    return glm::clamp((u32)app->bloomLevels, 1u, glm::min(maxLevels, (u32)BLOOM_MAX_LEVELS));
 }
 
 void FrameBufferObjectBloom(App* app) {
 
     //Bloom Textures
-    if (app->rtBright != 0)
-        glDeleteTextures(1, &app->rtBright);
-
-    glGenTextures(1, &app->rtBright);
-    glBindTexture(GL_TEXTURE_2D, app->rtBright);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x / 2, app->displaySize.y / 2, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, NULL);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    app->bloomChainLevels = BloomLevelCount(app);
+    BufferBloomTextureInit(app, app->rtBright);
+    BufferBloomTextureInit(app, app->rtBloomH);
 
-    if (app->rtBloomH != 0)
-        glDeleteTextures(1, &app->rtBloomH);
+    //Bloom FrameBuffer, the compute bloom only needs the textures
+    for (u32 level = 0; level < BLOOM_MAX_LEVELS; ++level)
+    {
+        if (level < app->bloomChainLevels)
+        {
+            BufferBloomInit(app, app->bloomFramebuffers[level], level);
+        }
+        else if (app->bloomFramebuffers[level] != 0)
+        {
+            glDeleteFramebuffers(1, &app->bloomFramebuffers[level]);
+            app->bloomFramebuffers[level] = 0;
+        }
+    }
+}
 
-    glGenTextures(1, &app->rtBloomH);
-    glBindTexture(GL_TEXTURE_2D, app->rtBloomH);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x / 2, app->displaySize.y / 2, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, NULL);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+void ResizeRenderTargets(App* app)
+{
+    app->renderSize = glm::max(app->displaySize, ivec2(1));
 
-    //Bloom FrameBuffer
-    BufferBloomInit(app, app->fboBloom1, 0);
-    BufferBloomInit(app, app->fboBloom2, 1);
-    BufferBloomInit(app, app->fboBloom3, 2);
-    BufferBloomInit(app, app->fboBloom4, 3);
-    BufferBloomInit(app, app->fboBloom5, 4);
+    // Targets of the previous size that nothing reuses are deleted by the next trim of the pool
+    BeginRenderTargetGeneration(app->renderTargets);
+    FrameBufferObject(app);
+    FrameBufferObjectBloom(app);
+    CreateHiZPyramid(app);
 }
 
 void Init(App* app)
@@ -466,6 +567,24 @@ void Init(App* app)
         glDebugMessageCallback(OnGlError, app);
     }
 
+    app->info.GLVers = (const char *)glGetString(GL_VERSION);
+    app->info.GLRender = (const char*)glGetString(GL_RENDERER);
+    app->info.GLVendor = (const char*)glGetString(GL_VENDOR);
+    app->info.GLSLVersion = (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
+
+    GLint num_extensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (int i = 0; i < num_extensions; ++i)
+    {
+        app->info.GLExtensions.push_back((const char*)glGetStringi(GL_EXTENSIONS, GLuint(i)));
+    }
+
+    // Programs and buffers below depend on which extensions are available
+    LoadGLExtensions(app->info);
+    InitProgramCache(app);
+    InitProgramReload();
+    const auto programsStart = std::chrono::high_resolution_clock::now();
+
     //VBO Initialization
     //Create vertex buffer
     app->vertexBuff = CreateStaticVertexBuffer(sizeof(vertices));
@@ -506,55 +625,136 @@ void Init(App* app)
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
     //Program 1 Initialization
-    app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "TEXTURED_GEOMETRY");
+    app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "TEXTURED_GEOMETRY", "");
     Program& texturedGeometryProgram = app->programs[app->texturedGeometryProgramIdx];
-    //app->programUniformTexture = glGetUniformLocation(texturedGeometryProgram.handle, "uTexture");
 
     //Program Forward shading Initialization
-    app->ForwardShadingIdx = LoadProgram(app, "shaders.glsl", "Mode_ForwardShading");
-    Program& texturedMeshProgram = app->programs[app->ForwardShadingIdx];
+    app->ForwardShadingIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_ForwardShading", "");
 
     //Program Deferred shading Initialization
-    app->DeferredGeometryIdx = LoadProgram(app, "shaders.glsl", "Mode_DeferredGeometry");
-    app->DeferredLightingIdx = LoadProgram(app, "shaders.glsl", "Mode_DeferredLighting");
+    app->DeferredGeometryIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_DeferredGeometry", "");
+    app->DeferredLightingIdx = LoadProgram(app, "shaders.glsl", "Mode_DeferredLighting", "");
+    app->DeferredLightingTiledIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_DeferredLightingTiled", "");
+
+    //Program Clustered forward Initialization
+    app->ForwardClusteredIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_ForwardShading", "#define CLUSTERED_LIGHTING\n");
+    app->DepthPrepassIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_DepthPrepass", "");
+    app->clusterLightsProgramIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_ClusterLights", "");
+
+    app->gBufferDebugIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_GBufferDebug", "");
+
+    //Bindless variants fetch material textures from the material buffer instead of texture units
+    if (GLExt.bindlessTexture)
+    {
+        app->ForwardShadingBindlessIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_ForwardShading", "#define BINDLESS_TEXTURES\n");
+        app->DeferredGeometryBindlessIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_DeferredGeometry", "#define BINDLESS_TEXTURES\n");
+        app->ForwardClusteredBindlessIdx = LoadProgramPermutations(app, "shaders.glsl", "Mode_ForwardShading", "#define BINDLESS_TEXTURES\n#define CLUSTERED_LIGHTING\n");
+
+        GLint forwardLinked, geometryLinked;
+        glGetProgramiv(app->programs[GetProgramVariant(app, app->ForwardShadingBindlessIdx, 0)].handle, GL_LINK_STATUS, &forwardLinked);
+        glGetProgramiv(app->programs[GetProgramVariant(app, app->DeferredGeometryBindlessIdx, 0)].handle, GL_LINK_STATUS, &geometryLinked);
+        app->bindlessSupported = forwardLinked && geometryLinked;
+    }
 
-    app->blitBrightestPixelsProgramIdx = LoadProgram(app, "shaders.glsl", "Mode_BrightestPixels");
-    app->blurIdx = LoadProgram(app, "shaders.glsl", "Mode_Blur");
-    app->bloomIdx = LoadProgram(app, "shaders.glsl", "Mode_Bloom");
+    if (!app->bindlessSupported)
+    {
+        ILOG("Bindless textures not available, binding material textures per draw");
+        app->ForwardShadingBindlessIdx = app->ForwardShadingIdx;
+        app->DeferredGeometryBindlessIdx = app->DeferredGeometryIdx;
+        app->ForwardClusteredBindlessIdx = app->ForwardClusteredIdx;
+    }
+    app->bindlessTextures = app->bindlessSupported;
+
+    app->blitBrightestPixelsProgramIdx = LoadProgram(app, "shaders.glsl", "Mode_BrightestPixels", "");
+    app->bloomIdx = LoadProgram(app, "shaders.glsl", "Mode_Bloom", "");
+    app->bloomDownsampleIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_BloomDownsample", "");
+    app->bloomUpsampleIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_BloomUpsample", "");
+    app->bloomCompositeIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_BloomComposite", "");
+
+    app->hiZProgramIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_HiZ", "");
+    app->occlusionCullProgramIdx = LoadComputeProgram(app, "shaders.glsl", "Mode_OcclusionCull", "");
+
+    const f64 programsTime = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - programsStart).count();
+    ILOG("Programs: %u from the binary cache, %u compiled, %.1f ms", app->programCacheHits, app->programCacheMisses, programsTime);
 
     //Texture Initialization
 
     app->whiteTexIdx = LoadTexture2D(app, "Plane/color_magenta.png");
+    app->blankTexIdx = LoadTexture2D(app, "Plane/color_white.png");
 
     //Texture bump Init
     app->albedobump = LoadTexture2D(app, "Bump/wood.png");
     app->normalbump = LoadTexture2D(app, "Bump/toy_box_normal.png");
-    app->heightbump = LoadTexture2D(app, "Bump/toy_box_disp.png");
+    app->heightbump = LoadConeMap(app, "Bump/toy_box_disp.png");
+
+
+    //Geometry arena, every mesh suballocates its vertices and indices from here
+    app->geometryVertexBuff = CreateStaticVertexBuffer(MB(32));
+    app->geometryIndexBuff = CreateStaticIndexBuffer(MB(8));
 
+    std::vector<u32> instanceIndices(MAX_INSTANCES);
+    for (u32 i = 0; i < MAX_INSTANCES; ++i)
+        instanceIndices[i] = i;
+    app->instanceIndexBuff = CreateStaticVertexBuffer(MAX_INSTANCES * sizeof(u32));
+    AppendData(app->instanceIndexBuff, instanceIndices.data(), MAX_INSTANCES * sizeof(u32), sizeof(u32));
+
+    glGenVertexArrays(1, &app->geometryVao);
+    glBindVertexArray(app->geometryVao);
+    BindBuffer(app->geometryVertexBuff);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, texCoord));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, tangent));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, bitangent));
+    glEnableVertexAttribArray(4);
+    // The base instance of each draw command offsets this attribute, giving every instance its global index
+    BindBuffer(app->instanceIndexBuff);
+    glVertexAttribIPointer(INSTANCE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+    glVertexAttribDivisor(INSTANCE_INDEX_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_INDEX_LOCATION);
+    BindBuffer(app->geometryIndexBuff);
+    glBindVertexArray(0);
+
+    // Positions and instance indices only, for the depth prepasses
+    glGenVertexArrays(1, &app->depthOnlyVao);
+    glBindVertexArray(app->depthOnlyVao);
+    BindBuffer(app->geometryVertexBuff);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+    glEnableVertexAttribArray(0);
+    BindBuffer(app->instanceIndexBuff);
+    glVertexAttribIPointer(INSTANCE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+    glVertexAttribDivisor(INSTANCE_INDEX_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_INDEX_LOCATION);
+    BindBuffer(app->geometryIndexBuff);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     //Load model patrick
     app->model = LoadModel(app, "Patrick/Patrick.obj");
     app->plane = LoadModel(app, "Plane/Plane.obj");
     app->bump = LoadModel(app, "Bump/Cube.fbx");
 
+    // The box file does not reference its normal and height maps
+    for (u32 materialIdx : app->models[app->bump].materialIdx)
+    {
+        Material& material = app->materials[materialIdx];
+        material.normalsTextureIdx = app->normalbump;
+        material.bumpTextureIdx = app->heightbump;
+        material.features |= ProgramFeature_NormalMap | ProgramFeature_ReliefMap;
+        LoadMaterialProgramVariants(app, material.features);
+    }
+    app->drawListDirty = true; // the features are part of the draw keys
+
 
     //app->plane = LoadPlane(app);
 
     app->mode = Mode::Mode_DeferredShading;
     app->modes = Modes::Mode_Color;
 
-    app->info.GLVers = (const char *)glGetString(GL_VERSION);
-    app->info.GLRender = (const char*)glGetString(GL_RENDERER);
-    app->info.GLVendor = (const char*)glGetString(GL_VENDOR);
-    app->info.GLSLVersion = (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
-
-    GLint num_extensions;
-    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
-    for (int i = 0; i < num_extensions; ++i)
-    {
-        app->info.GLExtensions.push_back((const char*)glGetStringi(GL_EXTENSIONS, GLuint(i)));
-    }
-
     //Camera stuff
     Camera& camera = app->cam;
     camera.y = 0.0f;
@@ -565,15 +765,36 @@ void Init(App* app)
 
 
     //Framebuffer Init
-    FrameBufferObject(app);
+    app->frameGraph.pool = &app->renderTargets;
+    ResizeRenderTargets(app);
     app->displaySizeLastFrame = app->displaySize;
 
     //Uniform buffers parameters
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBlockAlignment);
+
+    //create uniform buffer, one region per frame in flight
+    app->uniformBuff = CreateConstantRingBuffer(app->maxUniformBufferSize, app->framesInFlight);
+
+    //create instance buffer, model matrices of every instance drawn
+    app->instanceBuff = CreateRingBuffer(MAX_INSTANCES * sizeof(InstanceData), app->framesInFlight, GL_SHADER_STORAGE_BUFFER);
+
+    //create indirect buffer, one draw command per batch
+    //create indirect buffer, room for the two copies of the commands used by occlusion culling
+    app->indirectBuff = CreateRingBuffer(2 * MAX_INSTANCES * sizeof(DrawElementsIndirectCommand) + app->storageBlockAlignment, app->framesInFlight, GL_DRAW_INDIRECT_BUFFER);
+
+    //Persistent per-entity and global data, rewritten only where something changed
+    app->objectBuff = CreateBuffer(MAX_INSTANCES * sizeof(ObjectData), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+    app->globalParamsBuff = CreateBuffer(sizeof(GlobalParamsHeader), GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+
+    //Occlusion culling, only touched by the GPU except for the counters
+    app->culledInstanceBuff = CreateBuffer(2 * MAX_INSTANCES * sizeof(InstanceData), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->instanceVisibilityBuff = CreateBuffer(MAX_INSTANCES * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->occlusionStatsStride = Align(4 * sizeof(u32), app->storageBlockAlignment);
+    app->occlusionStatsBuff = CreateReadbackBuffer(MAX_FRAMES_IN_FLIGHT * app->occlusionStatsStride, GL_SHADER_STORAGE_BUFFER);
 
-    //create unifomr buffer
-    app->uniformBuff = CreateConstantBuffer(app->maxUniformBufferSize);
+    CreateClusterBuffers(app);
 
     app->heightBumpParam = 0.1f;
     app->texSize = 1000;
@@ -618,6 +839,7 @@ void Init(App* app)
     bump1.id = ++id;
     app->entities.push_back(bump1);
     app->gameObjects.push_back(GameObject("Bump Box", id, app->entities.size() - 1, GOType::ENTITY, &bump1.worldMatrix));
+    app->drawListDirty = true;
 
     // lights Creation
     Light light1;
@@ -649,8 +871,6 @@ void Init(App* app)
 
     app->active_gameObject = &app->gameObjects[0];
     GetTrasform(app, *app->active_gameObject->modelMatrix);
-
-    FrameBufferObjectBloom(app);
 }
 
 void ShowOverlay(App* app) {
@@ -681,6 +901,11 @@ void ShowOverlay(App* app) {
 }
 
 
+void Shutdown(App* app)
+{
+    ShutdownProgramReload(app);
+}
+
 void Gui(App* app)
 {
     bool active = true;
@@ -691,8 +916,25 @@ void Gui(App* app)
     ImGui::SameLine();
     ImGui::PushItemWidth(150);
     ImGui::Combo("Render Mode", &app->selectedmode, app->rmode, IM_ARRAYSIZE(app->rmode));
+    if (app->bindlessSupported)
+    {
+        ImGui::SameLine();
+        ImGui::Checkbox("Bindless", &app->bindlessTextures);
+    }
 
     ImGui::PopItemWidth();
+    ImGui::SameLine();
+    ImGui::Checkbox("Occlusion culling", &app->occlusionCulling);
+    if (app->mode != Mode::Mode_ClusteredForward)
+    {
+        ImGui::SameLine();
+        ImGui::Checkbox("Depth prepass", &app->depthPrepass);
+    }
+    if (app->occlusionCulling)
+    {
+        ImGui::SameLine();
+        ImGui::Text("drawn %u + %u, occluded %u", app->occlusionDrawnFirstPhase, app->occlusionDrawnSecondPhase, app->occlusionCulled);
+    }
     //ImGui::SameLine();
     //ImGui::Checkbox("Normal Map", &app->normalMap);
 
@@ -726,21 +968,23 @@ void Gui(App* app)
         ImGui::Image((void*)app->colorTexHandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
         break;
 
+    // The G-buffer channels are decoded into debugTexHandle by Render
     case Modes::Mode_Normal:
-        ImGui::Image((void*)app->normalTexhandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
-        break;
-
     case Modes::Mode_Albedo:
-        ImGui::Image((void*)app->albedoTexhandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
-        break;
-
     case Modes::Mode_Depth:
-        ImGui::Image((void*)app->depthTexhandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
-        break;
     case Modes::Mode_Position:
-        ImGui::Image((void*)app->positionTexhandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
+        ImGui::Image((void*)app->debugTexHandle, ImVec2(app->displaySize.x, app->displaySize.y), ImVec2(0, 1), ImVec2(1, 0));
         break;
     }
+
+    // Viewport picking, select the closest entity under the cursor
+    if (ImGui::IsItemClicked(0))
+    {
+        const ImVec2 mouse = ImGui::GetMousePos();
+        const ImVec2 imageMin = ImGui::GetItemRectMin();
+        const ImVec2 imageSize = ImGui::GetItemRectSize();
+        PickEntity(app, vec2((mouse.x - imageMin.x) / imageSize.x, (mouse.y - imageMin.y) / imageSize.y));
+    }
     switch (app->selectedmode)
     {
     case 0:
@@ -749,6 +993,9 @@ void Gui(App* app)
     case 1:
         app->mode = Mode::Mode_ForwardShading;
         break;
+    case 2:
+        app->mode = Mode::Mode_ClusteredForward;
+        break;
     }
 
     ImGui::End();
@@ -798,25 +1045,40 @@ void Gui(App* app)
 
                     if (app->lights[app->active_gameObject->index].direction != direction) {
                         app->lights[app->active_gameObject->index].direction = direction;
+                        app->lights[app->active_gameObject->index].dirty = true;
+                    }
+                }
+                else {
+                    f32 radius = app->lights[app->active_gameObject->index].radius;
+                    ImGui::PushItemWidth(60); ImGui::DragFloat("Radius", &radius, 0.1f, 0.1f, 1000.0f); ImGui::PopItemWidth();
+
+                    if (app->lights[app->active_gameObject->index].radius != radius) {
+                        app->lights[app->active_gameObject->index].radius = radius;
+                        app->lights[app->active_gameObject->index].dirty = true;
                     }
                 }
 
                 float color[3] = { app->lights[app->active_gameObject->index].color.r, app->lights[app->active_gameObject->index].color.g, app->lights[app->active_gameObject->index].color.b };
                 ImGui::ColorPicker3("color", color);
 
-                app->lights[app->active_gameObject->index].color.r = color[0];
-                app->lights[app->active_gameObject->index].color.g = color[1];
-                app->lights[app->active_gameObject->index].color.b = color[2];
+                if (app->lights[app->active_gameObject->index].color != vec3(color[0], color[1], color[2])) {
+                    app->lights[app->active_gameObject->index].color = vec3(color[0], color[1], color[2]);
+                    app->lights[app->active_gameObject->index].dirty = true;
+                }
             }
             
             if (last_position.x != app->vposition.x || last_position.y != app->vposition.y || last_position.z != app->vposition.z ||
                 last_rotation.x != app->vrotation.x || last_rotation.y != app->vrotation.y || last_rotation.z != app->vrotation.z ||
                 last_scale.x != app->vscale.x || last_scale.y != app->vscale.y || last_scale.z != app->vscale.z)
             {
-                if (app->active_gameObject->type == GOType::ENTITY)
+                if (app->active_gameObject->type == GOType::ENTITY) {
                     app->entities[app->active_gameObject->index].worldMatrix = TransformPositionRotationScale(app->vposition, (app->vrotation * 3.14159f) / 180.f, app->vscale);
-                else if (app->active_gameObject->type == GOType::LIGHT)
+                    app->entities[app->active_gameObject->index].dirty = true;
+                }
+                else if (app->active_gameObject->type == GOType::LIGHT) {
                     app->lights[app->active_gameObject->index].position = app->vposition;
+                    app->lights[app->active_gameObject->index].dirty = true;
+                }
             }
         }
     }
@@ -825,13 +1087,33 @@ void Gui(App* app)
     {
         ImGui::NewLine();
         ImGui::Checkbox("Active Bloom", &app->renderBloom);
+        ImGui::Checkbox("Tiled Lighting", &app->tiledLighting);
+        ImGui::SameLine();
+        if (ImGui::Button("Run light benchmark"))
+            app->runLightBenchmark = true;
+        ImGui::Checkbox("Compute Bloom", &app->computeBloom);
+        ImGui::SameLine();
+        if (ImGui::Button("Run bloom benchmark"))
+            app->runBloomBenchmark = true;
         ImGui::DragFloat("Threshold", &app->threshold, 0.01, 0, 1);
-        ImGui::DragInt("Kernel Radius", &app->kernelRadius, 0.1, 0, 50);
-        ImGui::SliderFloat("LOD0 Intensity", &app->LOD0, 0, 2);
-        ImGui::SliderFloat("LOD1 Intensity", &app->LOD1, 0, 2);
-        ImGui::SliderFloat("LOD2 Intensity", &app->LOD2, 0, 2);
-        ImGui::SliderFloat("LOD3 Intensity", &app->LOD3, 0, 2);
-        ImGui::SliderFloat("LOD4 Intensity", &app->LOD4, 0, 2);
+        if (!app->computeBloom)
+        {
+            // Only the preset radii, their programs are all built the first time the blur runs
+            int preset = 0;
+            while (preset + 1 < BLUR_RADIUS_PRESET_COUNT && BlurRadiusPresets[preset] < (u32)app->kernelRadius)
+                preset++;
+            char radius[16];
+            sprintf(radius, "%u", BlurRadiusPresets[preset]);
+            if (ImGui::SliderInt("Kernel Radius", &preset, 0, BLUR_RADIUS_PRESET_COUNT - 1, radius))
+                app->kernelRadius = BlurRadiusPresets[preset];
+        }
+        ImGui::SliderInt("Bloom Levels", &app->bloomLevels, 1, BLOOM_MAX_LEVELS);
+        for (u32 level = 0; level < app->bloomChainLevels; ++level)
+        {
+            char label[32];
+            sprintf(label, "LOD%u Intensity", level);
+            ImGui::SliderFloat(label, &app->bloomIntensity[level], 0, 2);
+        }
     }
 
 
@@ -839,13 +1121,37 @@ void Gui(App* app)
     ImGui::Checkbox("Bump", &app->heightMap);
     ImGui::DragFloat("Bump", &app->heightBumpParam, 0.1f, 0.0);
     ImGui::DragInt("Texture Size", &app->texSize, 1.0f, 0);
-    ImGui::DragInt("Relief Steps", &app->steps, 1.0f, 0);
+    ImGui::DragInt("Relief Steps", &app->steps, 1.0f, 1);
+    ImGui::Checkbox("Cone Step Mapping", &app->coneStepMapping);
+    ImGui::DragInt("Cone Steps", &app->coneSteps, 1.0f, 1, 64);
+    ImGui::DragFloat("Relief LOD Distance", &app->reliefLodDistance, 0.5f, 0.0f);
     ImGui::End();
 
 
     ImGui::Begin("Info");
     ImGui::Text("FPS:");
     ImGui::Text("   %f", 1.0f/app->deltaTime);
+    ImGui::Text("Draws:");
+    ImGui::Text("   %u visible of %u", app->visibleDrawCount, (u32)app->drawList.size());
+    ImGui::Checkbox("Frustum culling", &app->frustumCulling);
+    if (ImGui::Button("Run culling benchmark"))
+        RunCullingBenchmark();
+    ImGui::Text("Frame graph:");
+    ImGui::Text("   %u passes, %u culled", app->frameGraph.passCount, app->frameGraph.culledPassCount);
+    ImGui::Text("   %u clears, %u skipped", app->frameGraph.clearCount, app->frameGraph.skippedClearCount);
+    ImGui::Text("   transient %.1f MB, %u aliased", app->frameGraph.transientBytes / (1024.0 * 1024.0), app->frameGraph.aliasedCount);
+    ImGui::Text("GPU passes:");
+    f32 gpuTotal = 0.0f;
+    for (const FGPassTiming& timing : app->frameGraph.timings)
+    {
+        ImGui::Text("   %-24s %7.3f ms", timing.name, timing.milliseconds);
+        gpuTotal += timing.milliseconds;
+    }
+    ImGui::Text("   %-24s %7.3f ms", "Total", gpuTotal);
+    ImGui::Text("Render targets:");
+    ImGui::Text("   %d x %d, %.1f MB in %u textures", app->renderSize.x, app->renderSize.y, app->renderTargets.bytes / (1024.0 * 1024.0), (u32)app->renderTargets.targets.size());
+    ImGui::Text("Program reload:");
+    ImGui::Text("   last %.0f ms after save, %u pending", app->programReloadLatency * 1000.0, (u32)app->programBuilds.size());
     ImGui::Text("OpenGL version:");
     ImGui::Text("   %s", app->info.GLVers.c_str());
     ImGui::Text("OpenGL render:");
@@ -864,6 +1170,32 @@ void Gui(App* app)
     ImGui::End();
 }
 
+void PickEntity(App* app, vec2 viewportPosition)
+{
+    // Unproject the cursor at the near and far planes to build the picking ray
+    const vec2 ndc = vec2(viewportPosition.x * 2.0f - 1.0f, 1.0f - viewportPosition.y * 2.0f);
+    const glm::mat4 inverseViewProjection = glm::inverse(app->projection * app->view);
+    const vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+    const vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+    const vec3 origin = vec3(nearPoint) / nearPoint.w;
+    const vec3 direction = glm::normalize(vec3(farPoint) / farPoint.w - origin);
+
+    f32 distance;
+    const i32 entityIdx = QueryRay(app->sceneBVH, origin, direction, distance);
+    if (entityIdx < 0)
+        return;
+
+    for (u32 i = 0; i < app->gameObjects.size(); ++i)
+    {
+        if (app->gameObjects[i].type == GOType::ENTITY && app->gameObjects[i].index == (u32)entityIdx)
+        {
+            app->active_gameObject = &app->gameObjects[i];
+            GetTrasform(app, app->entities[entityIdx].worldMatrix);
+            break;
+        }
+    }
+}
+
 void GetTrasform(App* app, glm::mat4 matrix) {
     glm::quat rotation;
     glm::vec3 skew;
@@ -908,18 +1240,25 @@ void CreateHierarchy(App* app, GameObject* parent) {
 
 void Update(App* app)
 {
+    // Rebuilt programs are swapped before anything of the frame uses them
+    ApplyProgramBuilds(app);
+
     // You can handle app->input keyboard/mouse here
-    for (u64 i = 0; i < app->programs.size(); ++i)
+    FileChange change;
+    while (PopFileChange(&change))
     {
-        Program& program = app->programs[i];
-        u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
-        if (currentTimestamp > program.lastWriteTimestamp)
+        // Read and parsed once for all the programs of the file
+        ProgramSource source;
+        for (u64 i = 0; i < app->programs.size(); ++i)
         {
-            glDeleteProgram(program.handle);
-            String programSource = ReadTextFile(program.filepath.c_str());
-            const char* programName = program.programName.c_str();
-            program.handle = CreateProgramFromSource(programSource, programName);
-            program.lastWriteTimestamp = currentTimestamp;
+            Program& program = app->programs[i];
+            if (program.fileWatch == change.watch && change.timestamp > program.lastWriteTimestamp)
+            {
+                if (!source.text)
+                    source = PreprocessProgramSource(ReadTextFile(program.filepath.c_str()));
+                program.lastWriteTimestamp = change.timestamp;
+                RequestProgramBuild(app, i, change.timestamp, source);
+            }
         }
     }
 
@@ -1015,7 +1354,7 @@ void Update(App* app)
     glm::vec3 upVector = glm::vec3(0.0f, 1.0f, 0.0f);
     float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
     
-    app->projection = glm::perspective(glm::radians(60.0f), aspectRatio, 0.1f, 1000.0f);
+    app->projection = glm::perspective(glm::radians(60.0f), aspectRatio, app->zNear, app->zFar);
     if (c.cMode == CamMode::ORBITAL)
     {
         app->view = glm::lookAt(c.position, c.cameraReference, upVector);
@@ -1026,141 +1365,278 @@ void Update(App* app)
     }
     app->modl = glm::mat4(1.0f);
 
+    //Draw list update
+    UpdateDrawList(app);
+    UpdateSceneBVH(app);
+    CullDrawList(app);
+
+    //Material params, only materials that changed are re-uploaded
+    UpdateMaterialBuffer(app);
+
+    //Object params, only entities that moved are re-uploaded
+    UpdateObjectBuffer(app);
+
+    //Global params and the lights that changed
+    UpdateGlobalParams(app);
+
     //Uniform Buffer update
-    MapBuffer(app->uniformBuff, GL_WRITE_ONLY);
+    BeginRingRegion(app->uniformBuff);
 
-    //Global params
+    //Local Params
+    AlignHead(app->uniformBuff, app->uniformBlockAlignment);
 
-    app->GlobalParamsOffset = app->uniformBuff.head;
+    app->LocalParamsOffset = app->uniformBuff.head;
+    PushMat4(app->uniformBuff, app->view);
+    PushMat4(app->uniformBuff, app->projection);
+    app->LocalParamsSize = app->uniformBuff.head - app->LocalParamsOffset;
 
-    PushVec3(app->uniformBuff, app->cam.position);
+    EndRingRegion(app->uniformBuff);
 
-    PushUInt(app->uniformBuff, app->lights.size());
+    //Instance Params and draw commands
+    BeginRingRegion(app->instanceBuff);
+    BeginRingRegion(app->indirectBuff);
+    BuildDrawBatches(app);
+    EndRingRegion(app->indirectBuff);
+    EndRingRegion(app->instanceBuff);
 
-    for (int i = 0; i < app->lights.size(); ++i)
+    //framebuffer check if window resize. While the panel is being resized the frame is rendered at
+    //the size of the current targets and scaled to the panel, they are reallocated once it settles
+    if (app->displaySize != app->displaySizeLastFrame)
     {
-        AlignHead(app->uniformBuff, sizeof(vec4));
-
-        Light& light = app->lights[i];
-        PushUInt(app->uniformBuff, light.type);
-        PushVec3(app->uniformBuff, light.color);
-        PushVec3(app->uniformBuff, light.direction);
-        PushVec3(app->uniformBuff, light.position);
+        app->displaySizeLastFrame = app->displaySize;
+        app->resizeStableFrames = 0;
+    }
+    else if (app->resizeStableFrames < RESIZE_STABLE_FRAMES)
+    {
+        app->resizeStableFrames++;
     }
 
-    app->GlobalParamsSize = app->uniformBuff.head - app->GlobalParamsOffset;
+    if (app->resizeStableFrames == RESIZE_STABLE_FRAMES && app->renderSize != app->displaySize && app->displaySize.x > 0 && app->displaySize.y > 0)
+        ResizeRenderTargets(app);
+    else if (BloomLevelCount(app) != app->bloomChainLevels)
+        FrameBufferObjectBloom(app);
+}
 
-    //Local Params
-    for (int i = 0; i < app->entities.size(); ++i)
+void UpdateGlobalParams(App* app)
+{
+    // First, it may grow the buffer and change the capacity
+    UpdateLightBuffer(app);
+
+    GlobalParamsHeader header = {};
+    header.cameraPosition = app->cam.position;
+    header.lightCount = (u32)app->lights.size();
+    header.lightCapacity = app->lightCapacity;
+
+    if (app->globalParamsDirty ||
+        header.cameraPosition != app->globalParamsHeader.cameraPosition ||
+        header.lightCount != app->globalParamsHeader.lightCount ||
+        header.lightCapacity != app->globalParamsHeader.lightCapacity)
+    {
+        UpdateData(app->globalParamsBuff, 0, &header, sizeof(header));
+        app->globalParamsHeader = header;
+        app->globalParamsDirty = false;
+    }
+}
+
+void UpdateMaterialBuffer(App* app)
+{
+    // Handles stay resident for the lifetime of the texture, which the engine never frees. They are
+    // only created if bindless is supported, and kept when it is switched off.
+    auto residentHandle = [app](u32 textureIdx) -> GLuint64
     {
+        if (!app->bindlessSupported || textureIdx >= app->textures.size())
+            return 0;
 
-        AlignHead(app->uniformBuff, app->uniformBlockAlignment);
+        Texture& texture = app->textures[textureIdx];
+        if (texture.bindlessHandle == 0)
+        {
+            texture.bindlessHandle = glGetTextureHandleARB(texture.handle);
+            glMakeTextureHandleResidentARB(texture.bindlessHandle);
+        }
+        return texture.bindlessHandle;
+    };
 
-        Entity& entity = app->entities[i];
-        glm::mat4        model = entity.worldMatrix;
-        glm::mat4        view = app->view;
-        glm::mat4        projection = app->projection;
+    // The G-buffer stores the material id in 16 bits
+    ASSERT(app->materials.size() <= MAX_MATERIALS, "Too many materials for the G-buffer material id");
 
-        entity.localParamsOffset = app->uniformBuff.head;
-        PushMat4(app->uniformBuff, model);
-        PushMat4(app->uniformBuff, view);
-        PushMat4(app->uniformBuff, projection);
-        entity.localParamsSize = app->uniformBuff.head - entity.localParamsOffset;
+    // Grows to fit every material, everything is uploaded again into the new buffer
+    const u32 size = (u32)(app->materials.size() * sizeof(MaterialData));
+    if (app->materialBuff.size < size)
+    {
+        if (app->materialBuff.handle)
+            glDeleteBuffers(1, &app->materialBuff.handle);
+        app->materialBuff = CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
 
+        for (Material& material : app->materials)
+            material.dirty = true;
     }
-    
-    UnmapBuffer(app->uniformBuff);
 
-    //framebuffer check if window resize
-    if (app->displaySize != app->displaySizeLastFrame)
+    // Consecutive dirty materials are uploaded together, clean ones are never touched
+    std::vector<MaterialData> range;
+    u32 rangeStart = 0;
+
+    for (u32 i = 0; i <= app->materials.size(); ++i)
     {
-        FrameBufferObject(app);
-        FrameBufferObjectBloom(app);
-        app->displaySizeLastFrame = app->displaySize;
+        if (i < app->materials.size() && app->materials[i].dirty)
+        {
+            Material& material = app->materials[i];
+            if (range.empty())
+                rangeStart = i;
+
+            MaterialData data = {};
+            data.albedo = vec4(material.albedo, material.smoothness);
+            data.emissive = vec4(material.emissive, 0.0f);
+            data.albedoTexture = residentHandle(material.albedoTextureIdx);
+            if (material.features & ProgramFeature_NormalMap)
+                data.normalTexture = residentHandle(material.normalsTextureIdx);
+            if (material.features & ProgramFeature_ReliefMap)
+                data.heightTexture = residentHandle(material.bumpTextureIdx);
+            range.push_back(data);
+            material.dirty = false;
+        }
+        else if (!range.empty())
+        {
+            UpdateData(app->materialBuff, rangeStart * sizeof(MaterialData), range.data(), range.size() * sizeof(MaterialData));
+            range.clear();
+        }
     }
 }
 
-void DeferredGeometryPass(App * app)
+// Features of the variant drawing a material, those turned off in the GUI left out
+static u32 EnabledProgramFeatures(const App* app, u32 materialFeatures)
 {
-    // Clear the framebuffer
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
-
+    u32 features = materialFeatures;
+    if (!app->normalMap)
+        features &= ~ProgramFeature_NormalMap;
+    if (!app->heightMap)
+        features &= ~ProgramFeature_ReliefMap;
+    if ((features & ProgramFeature_ReliefMap) && app->coneStepMapping)
+        features |= ProgramFeature_ConeStep;
+    return features;
+}
 
-    //Select on which render targets to draw
-    GLuint drawbuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4 };
-    glDrawBuffers(ARRAY_COUNT(drawbuffers), drawbuffers);
+void RenderDrawList(App* app, u32 permutationsIdx, bool reuseCulling, bool depthOnly, const ProgramSetup& setup)
+{
+    // Binds the variant for the features if it is not bound yet. Normal and relief mapping state is
+    // the same for every draw, so it is only set when the program changes.
+    GLuint boundProgram = 0;
+    auto bindVariant = [&](u32 materialFeatures)
+    {
+        const u32 programIdx = GetProgramVariant(app, permutationsIdx, depthOnly ? 0 : EnabledProgramFeatures(app, materialFeatures));
+        Program& program = app->programs[programIdx];
+        if (program.handle == boundProgram)
+            return;
+
+        glUseProgram(program.handle);
+        boundProgram = program.handle;
+
+        glUniform1i(UniformLocation(program, UNIFORM("uTexture")), 0);
+        glUniform1i(UniformLocation(program, UNIFORM("uNormalTex")), 1);
+        glUniform1i(UniformLocation(program, UNIFORM("uHeightTex")), 2);
+        glUniform1f(UniformLocation(program, UNIFORM("uHeightBump")), app->heightBumpParam);
+        glUniform1i(UniformLocation(program, UNIFORM("texSize")), app->texSize);
+        glUniform1i(UniformLocation(program, UNIFORM("steps")), app->steps);
+        glUniform1i(UniformLocation(program, UNIFORM("coneSteps")), app->coneSteps);
+        glUniform1f(UniformLocation(program, UNIFORM("uReliefLodDistance")), app->reliefLodDistance);
+
+        if (setup)
+            setup(program);
+    };
 
-    // Clear the framebuffer
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    // Parameters (and with bindless, texture handles) of every material, indexed with the material of each instance
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), app->materialBuff.handle);
 
-    // Bind the program
-    Program& GeoDeferredShadingProgram = app->programs[app->DeferredGeometryIdx];
-    glUseProgram(GeoDeferredShadingProgram.handle);
-        
-    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->uniformBuff.handle, app->GlobalParamsOffset, app->GlobalParamsSize);
+    glEnable(GL_DEPTH_TEST);
 
-    for (int i = 0; i < app->entities.size(); ++i)
-    {
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->uniformBuff.handle, app->LocalParamsOffset, app->LocalParamsSize);
 
-        Model& model = app->models[app->entities[i].modelIndex];
-        Mesh& mesh = app->meshes[model.meshIdx];
+    if (app->drawBuckets.empty())
+        return;
 
-        //Send Uniforms
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->uniformBuff.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+    // Submits every bucket, instances is the buffer range the commands' base instances index into
+    auto submitBuckets = [&](GLuint instances, u32 instancesOffset, u32 commandsOffset)
+    {
+        // Object and material of every instance, indexed by the instance index attribute
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(2), instances, instancesOffset, app->InstanceParamsSize);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->objectBuff.handle);
 
-        glEnable(GL_DEPTH_TEST);
+        // Every mesh lives in the geometry arena, so the vertex array is bound once
+        glBindVertexArray(depthOnly ? app->depthOnlyVao : app->geometryVao);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->indirectBuff.handle);
 
-        for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+        // Only bind what changed since the previous bucket
+        GLuint lastTextures[3] = {};
+        auto bindTexture = [&](u32 unit, u32 textureIdx)
         {
-            GLuint vao = FindVAO(mesh, j, GeoDeferredShadingProgram);
-            glBindVertexArray(vao);
-
-            u32 submeshMaterialIdx = model.materialIdx[j];
-            Material& submeshMaterial = app->materials[submeshMaterialIdx];
-
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-            glUniform1i(app->programUniformTexture, 0);
+            const GLuint texture = app->textures[textureIdx].handle;
+            if (texture == lastTextures[unit])
+                return;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            lastTextures[unit] = texture;
+        };
+
+        for (u32 i = 0; i < app->drawBuckets.size(); ++i)
+        {
+            const DrawBucket& bucket = app->drawBuckets[i];
+            const DrawItem& item = app->drawList[app->drawBatches[bucket.firstBatch].firstItem];
 
-            // Normal mapping passing info and creating  textures for shader
-            if (app->normalMap)
-            {
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, app->textures[app->normalbump].handle);
-                glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "uNormalTex"), 1);
-
-                if (app->entities[i].modelIndex == app->bump)
-                    glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "normalMapBool"), 1);
-                else
-                    glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "normalMapBool"), 0);
-            }
+            bindVariant(item.features);
 
-            // Relief mapping passing info and creating  textures for shader
-            if (app->heightMap)
+            // Buckets only split where the textures change, parameters come from the material buffer
+            const Material& material = app->materials[item.materialIdx];
+            if (!depthOnly && !app->bindlessTextures)
             {
-                glActiveTexture(GL_TEXTURE2);
-                glBindTexture(GL_TEXTURE_2D, app->textures[app->heightbump].handle);
-                glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "uHeightTex"), 2);
-                glUniform1f(glGetUniformLocation(GeoDeferredShadingProgram.handle, "uHeightBump"), app->heightBumpParam);
-                glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "texSize"), app->texSize);
-                glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "steps"), app->steps);
-
-                if (app->entities[i].modelIndex == app->bump)
-                    glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "heightMapBool"), 1);
-                else
-                    glUniform1i(glGetUniformLocation(GeoDeferredShadingProgram.handle, "heightMapBool"), 0);
+                bindTexture(0, material.albedoTextureIdx);
+                if (material.features & ProgramFeature_NormalMap)
+                    bindTexture(1, material.normalsTextureIdx);
+                if (material.features & ProgramFeature_ReliefMap)
+                    bindTexture(2, material.bumpTextureIdx);
+                glActiveTexture(GL_TEXTURE0);
             }
 
-                // Draw elements
-                Submesh& submesh = mesh.submeshes[j];
-                glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(commandsOffset + bucket.commandOffset), bucket.batchCount, 0);
         }
 
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    };
+
+    if (!app->occlusionCulling)
+    {
+        submitBuckets(app->instanceBuff.handle, app->InstanceParamsOffset, app->CommandsOffset);
+        return;
     }
+
+    if (reuseCulling)
+    {
+        submitBuckets(app->culledInstanceBuff.handle, 0, app->CommandsOffset);
+        submitBuckets(app->culledInstanceBuff.handle, MAX_INSTANCES * sizeof(InstanceData), app->OcclusionCommandsOffset);
+        return;
+    }
+
+    // Compute dispatches switch programs, so the draw program is bound again before each phase
+    BeginOcclusionStats(app);
+
+    DispatchOcclusionCull(app, 0);
+    boundProgram = 0;
+    submitBuckets(app->culledInstanceBuff.handle, 0, app->CommandsOffset);
+
+    BuildHiZPyramid(app);
+
+    DispatchOcclusionCull(app, 1);
+    boundProgram = 0;
+    submitBuckets(app->culledInstanceBuff.handle, MAX_INSTANCES * sizeof(InstanceData), app->OcclusionCommandsOffset);
+}
+
+void DeferredGeometryPass(App * app, bool reuseCulling)
+{
+    // The frame graph bound and cleared the G-buffer targets
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+
+    // Binds the program variants itself
+    RenderDrawList(app, app->bindlessTextures ? app->DeferredGeometryBindlessIdx : app->DeferredGeometryIdx, reuseCulling);
 }
 
 void DeferredShadingPass(App * app)
@@ -1169,26 +1645,29 @@ void DeferredShadingPass(App * app)
     Program& ShadDeferredShadingProgram = app->programs[app->DeferredLightingIdx];
     glUseProgram(ShadDeferredShadingProgram.handle);
 
-    glUniform1i(glGetUniformLocation(ShadDeferredShadingProgram.handle, "oNormals"), 0);
-    glUniform1i(glGetUniformLocation(ShadDeferredShadingProgram.handle, "oAlbedo"), 1);
-    glUniform1i(glGetUniformLocation(ShadDeferredShadingProgram.handle, "oDepth"), 2);
-    glUniform1i(glGetUniformLocation(ShadDeferredShadingProgram.handle, "oPosition"), 3);
+    glUniform1i(UniformLocation(ShadDeferredShadingProgram, UNIFORM("oNormals")), 0);
+    glUniform1i(UniformLocation(ShadDeferredShadingProgram, UNIFORM("oAlbedo")), 1);
+    glUniform1i(UniformLocation(ShadDeferredShadingProgram, UNIFORM("oDepth")), 2);
+    glUniform1i(UniformLocation(ShadDeferredShadingProgram, UNIFORM("oMaterial")), 3);
+    glUniformMatrix4fv(UniformLocation(ShadDeferredShadingProgram, UNIFORM("uInvViewProjection")), 1, GL_FALSE, glm::value_ptr(glm::inverse(app->projection * app->view)));
      
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, app->normalTexhandle);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, app->albedoTexhandle);
     glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, app->depthTexhandle);
+    glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, app->positionTexhandle);
+    glBindTexture(GL_TEXTURE_2D, app->materialTexHandle);
+    glActiveTexture(GL_TEXTURE0);
 
-    //Select on which render targets to draw
-    GLuint drawbuffers[] = { GL_COLOR_ATTACHMENT0 };
-    glDrawBuffers(ARRAY_COUNT(drawbuffers), drawbuffers);
+    // The depth attachment is sampled, so it must not be tested or written
+    glDisable(GL_DEPTH_TEST);
     
     glDepthMask(GL_FALSE); //Send Uniforms
-    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->uniformBuff.handle, app->GlobalParamsOffset, app->GlobalParamsSize);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->lightBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), app->materialBuff.handle);
     
     //quad for deferred
     glBindVertexArray(app->quadVAO);
@@ -1196,196 +1675,313 @@ void DeferredShadingPass(App * app)
     glBindVertexArray(0);
 
     glDepthMask(GL_TRUE); 
+    glEnable(GL_DEPTH_TEST);
 }
 
-void Render(App* app)
+void DeferredShadingTiledPass(App * app)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom1);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom2);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom3);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom4);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "Tiled Lighting");
 
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom5);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    Program& program = app->programs[app->DeferredLightingTiledIdx];
+    glUseProgram(program.handle);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUniform1i(UniformLocation(program, UNIFORM("uNormals")), 0);
+    glUniform1i(UniformLocation(program, UNIFORM("uAlbedo")), 1);
+    glUniform1i(UniformLocation(program, UNIFORM("uDepth")), 2);
+    glUniform1i(UniformLocation(program, UNIFORM("uMaterialIds")), 3);
 
-    // Set the viewport
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    // Positions are reconstructed from depth, the inverses are computed once here instead of per pixel
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uView")), 1, GL_FALSE, glm::value_ptr(app->view));
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uInvView")), 1, GL_FALSE, glm::value_ptr(glm::inverse(app->view)));
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uInvProjection")), 1, GL_FALSE, glm::value_ptr(glm::inverse(app->projection)));
 
-    switch (app->mode)
-    {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->normalTexhandle);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, app->albedoTexhandle);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, app->materialTexHandle);
+    glActiveTexture(GL_TEXTURE0);
 
-    case Mode_ForwardShading:
-    {
-        //Render on this framebuffer render targets
-        glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->lightBuff.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), app->materialBuff.handle);
+    glBindImageTexture(0, app->colorTexHandle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
 
-        //Select on which render targets to draw
-        GLuint drawbuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4 };
-        glDrawBuffers(ARRAY_COUNT(drawbuffers), drawbuffers);
+    glDispatchCompute((app->renderSize.x + 15) / 16, (app->renderSize.y + 15) / 16, 1);
 
-        // Clear the framebuffer
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    // Bloom samples the result and the final composite blends over it
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
 
-        // Bind the program
-        Program& ForwardShadingProgram = app->programs[app->ForwardShadingIdx];
-        glUseProgram(ForwardShadingProgram.handle);
+    glUseProgram(0);
+    glPopDebugGroup();
+}
 
-        for (int i = 0; i < app->entities.size(); ++i)
-        {
+void DecodeGBufferDebugView(App* app)
+{
+    Program& program = app->programs[app->gBufferDebugIdx];
+    glUseProgram(program.handle);
 
-            Model& model = app->models[app->entities[i].modelIndex];
-            Mesh& mesh = app->meshes[model.meshIdx];
+    glUniform1i(UniformLocation(program, UNIFORM("uNormals")), 0);
+    glUniform1i(UniformLocation(program, UNIFORM("uAlbedo")), 1);
+    glUniform1i(UniformLocation(program, UNIFORM("uDepth")), 2);
+    glUniform1i(UniformLocation(program, UNIFORM("uView")), app->modes);
+    glUniform1f(UniformLocation(program, UNIFORM("uDepthRange")), app->zFar);
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uProjection")), 1, GL_FALSE, glm::value_ptr(app->projection));
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uInvViewProjection")), 1, GL_FALSE, glm::value_ptr(glm::inverse(app->projection * app->view)));
 
-            //Send Uniforms
-            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->uniformBuff.handle, app->GlobalParamsOffset, app->GlobalParamsSize);
-            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->uniformBuff.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->normalTexhandle);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, app->albedoTexhandle);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+    glActiveTexture(GL_TEXTURE0);
 
-            glEnable(GL_DEPTH_TEST);
+    glBindImageTexture(0, app->debugTexHandle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute((app->renderSize.x + 7) / 8, (app->renderSize.y + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
-            for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-            {
-                GLuint vao = FindVAO(mesh, j, ForwardShadingProgram);
-                glBindVertexArray(vao);
+    glUseProgram(0);
+}
 
-                u32 submeshMaterialIdx = model.materialIdx[j];
-                Material& submeshMaterial = app->materials[submeshMaterialIdx];
+// Depth only pass over the draw list, the shading pass after it tests for equality so each pixel
+// runs the material shader once. It also does the occlusion culling the shading pass reuses.
+static u32 AddDepthPrepass(App* app, u32 depth)
+{
+    FrameGraph& fg = app->frameGraph;
+    const u32 prepass = FGAddPass(fg, "Depth Prepass", [app](const FGPass&) {
+        RenderDrawList(app, app->DepthPrepassIdx, false, true);
+    });
+    return FGWriteDepth(fg, prepass, depth, true);
+}
 
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                glUniform1i(app->programUniformTexture, 0);
-
-                // Normal mapping passing info and creating  textures for shader
-                if (app->normalMap)
-                {
-                    glActiveTexture(GL_TEXTURE1);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[app->normalbump].handle);
-                    glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "uNormalTex"), 1);
-
-                    if (app->entities[i].modelIndex == app->bump)
-                        glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "normalMapBool"), 1);
-                    else
-                        glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "normalMapBool"), 0);
-                }
+static void BeginDepthEqual(bool prepass)
+{
+    if (!prepass)
+        return;
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
 
-                // Relief mapping passing info and creating  textures for shader
-                if (app->heightMap)
-                {
-                    glActiveTexture(GL_TEXTURE2);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[app->heightbump].handle);
-                    glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "uHeightTex"), 2);
-                    glUniform1f(glGetUniformLocation(ForwardShadingProgram.handle, "uHeightBump"), app->heightBumpParam);
-                    glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "texSize"), app->texSize);
-                    glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "steps"), app->steps);
-
-                    if (app->entities[i].modelIndex == app->bump)
-                        glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "heightMapBool"), 1);
-                    else
-                        glUniform1i(glGetUniformLocation(ForwardShadingProgram.handle, "heightMapBool"), 0);
-                }
+static void EndDepthEqual(bool prepass)
+{
+    if (!prepass)
+        return;
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+}
 
-                // Draw elements
-                Submesh& submesh = mesh.submeshes[j];
-                glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-            }
+void Render(App* app)
+{
+    // Passes only declare what they read and write, the graph culls the ones whose results are not
+    // displayed (the selected debug view included), binds their targets and issues their clears
+    FrameGraph& fg = app->frameGraph;
+    FGBegin(fg);
+
+    u32 color = FGImport(fg, "Color", app->colorTexHandle, app->renderSize, GL_RGBA8);
+    u32 depth = FGImport(fg, "Depth", app->depthAttachmentHandle, app->renderSize, GL_DEPTH_COMPONENT24);
+    u32 debug = FGImport(fg, "Debug View", app->debugTexHandle, app->renderSize, GL_RGBA8);
+    u32 normals = FGCreateTexture(fg, "Normals", app->renderSize, GL_RG16);
+    u32 albedo = FGCreateTexture(fg, "Albedo", app->renderSize, GL_RGBA8);
+    u32 material = FGCreateTexture(fg, "Material", app->renderSize, GL_R16UI); // only the deferred lighting reads it
 
-        }
+    switch (app->mode)
+    {
 
-        glPopDebugGroup();
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    case Mode_ForwardShading:
+    {
+        const bool prepass = app->depthPrepass;
+        if (prepass)
+            depth = AddDepthPrepass(app, depth);
 
-        break;
+        const u32 forward = FGAddPass(fg, "Forward Shading", [app, prepass](const FGPass&) {
+            //Send Uniforms
+            glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->lightBuff.handle);
+
+            BeginDepthEqual(prepass);
+            RenderDrawList(app, app->bindlessTextures ? app->ForwardShadingBindlessIdx : app->ForwardShadingIdx, prepass);
+            EndDepthEqual(prepass);
+        });
+        color = FGWriteColor(fg, forward, color, 0, true);
+        normals = FGWriteColor(fg, forward, normals, 1, true);
+        albedo = FGWriteColor(fg, forward, albedo, 2, true);
+        if (prepass)
+            FGReadDepth(fg, forward, depth);
+        else
+            depth = FGWriteDepth(fg, forward, depth, true);
     }
+    break;
+    case Mode_ClusteredForward:
+    {
+        u32 clusters = FGImport(fg, "Clusters", app->clusterGridBuff.handle);
+
+        const u32 build = FGAddPass(fg, "Cluster Lights", [app](const FGPass&) {
+            BuildClusters(app);
+        });
+        clusters = FGWrite(fg, build, clusters);
+
+        // Always has a depth prepass, so the relief mapping and lighting below run once per visible pixel
+        depth = AddDepthPrepass(app, depth);
+
+        const u32 shading = FGAddPass(fg, "Clustered Forward", [app](const FGPass&) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuff.handle);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->lightBuff.handle);
+
+            BeginDepthEqual(true);
+            RenderDrawList(app, app->bindlessTextures ? app->ForwardClusteredBindlessIdx : app->ForwardClusteredIdx, true, false,
+                           [app](Program& program) { BindClusters(app, program); });
+            EndDepthEqual(true);
+        });
+        FGRead(fg, shading, clusters);
+        FGReadDepth(fg, shading, depth);
+        color = FGWriteColor(fg, shading, color, 0, true);
+        normals = FGWriteColor(fg, shading, normals, 1, true);
+        albedo = FGWriteColor(fg, shading, albedo, 2, true);
+    }
+    break;
     case Mode_DeferredShading:
     {
-        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Deferred Shading");
+        const bool prepass = app->depthPrepass;
+        if (prepass)
+            depth = AddDepthPrepass(app, depth);
+
+        const u32 geometry = FGAddPass(fg, "Geometry Pass", [app, prepass](const FGPass&) {
+            BeginDepthEqual(prepass);
+            DeferredGeometryPass(app, prepass);
+            EndDepthEqual(prepass);
+        });
+        normals = FGWriteColor(fg, geometry, normals, 1, true);
+        albedo = FGWriteColor(fg, geometry, albedo, 2, true);
+        material = FGWriteColor(fg, geometry, material, 3, true);
+        if (prepass)
+            FGReadDepth(fg, geometry, depth);
+        else
+            depth = FGWriteDepth(fg, geometry, depth, true);
 
-        DeferredGeometryPass(app);
-        DeferredShadingPass(app);
+        if (app->runLightBenchmark)
+        {
+            const u32 benchmark = FGAddPass(fg, "Light Benchmark", [app](const FGPass&) {
+                RunLightBenchmark(app);
+                app->runLightBenchmark = false;
+            });
+            FGRead(fg, benchmark, normals);
+            FGRead(fg, benchmark, albedo);
+            FGRead(fg, benchmark, material);
+            FGRead(fg, benchmark, depth);
+            color = FGWriteColor(fg, benchmark, color, 0, false);
+
+            // The results are logged, not displayed, so nothing else keeps the pass alive
+            FGSetOutput(fg, color);
+        }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        // The tiled pass stores to the color texture, it is still attached so both passes draw the same way
+        const u32 lighting = FGAddPass(fg, "Lighting Pass", [app](const FGPass&) {
+            if (app->tiledLighting)
+                DeferredShadingTiledPass(app);
+            else
+                DeferredShadingPass(app);
+        });
+        FGRead(fg, lighting, normals);
+        FGRead(fg, lighting, albedo);
+        FGRead(fg, lighting, material);
+        FGRead(fg, lighting, depth);
+        color = FGWriteColor(fg, lighting, color, 0, false);
+
+        if (app->renderBloom && app->computeBloom)
+        {
+            const u32 bloom = FGAddPass(fg, "Render Bloom (compute)", [app](const FGPass&) {
+                RenderBloomCompute(app);
+            });
+            FGRead(fg, bloom, color);
+            color = FGWrite(fg, bloom, color);
+        }
+        else if (app->renderBloom)
+        {
+            const u32 bloom = FGAddPass(fg, "Render Bloom", [app](const FGPass& pass) {
+                RenderBloom(app, pass.framebuffer);
+            });
+            color = FGWriteColor(fg, bloom, color, 0, false);
+        }
+    }
+    break;
+    }
 
-        if (app->renderBloom) RenderBloom(app);
+    if (app->modes != Modes::Mode_Color)
+    {
+        const u32 decode = FGAddPass(fg, "G-buffer Debug View", [app](const FGPass&) {
+            DecodeGBufferDebugView(app);
+        });
+        FGRead(fg, decode, depth);
+        if (app->modes == Modes::Mode_Albedo)
+            FGRead(fg, decode, albedo);
+        if (app->modes == Modes::Mode_Normal)
+            FGRead(fg, decode, normals);
+        debug = FGWrite(fg, decode, debug);
+        FGSetOutput(fg, debug);
+    }
+    else
+    {
+        FGSetOutput(fg, color);
+    }
 
-        Program& programTexturedGeometry = app->programs[app->texturedGeometryProgramIdx];
-        glUseProgram(programTexturedGeometry.handle);
-        glBindVertexArray(app->vao);
+    FGCompile(fg);
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // The passes sample the G-buffer through these, they are 0 when nobody reads them this frame
+    app->normalTexhandle = FGTexture(fg, normals);
+    app->albedoTexhandle = FGTexture(fg, albedo);
+    app->materialTexHandle = FGTexture(fg, material);
 
-        glUniform1i(app->programUniformTexture, 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, app->colorTexHandle);
+    FGExecute(fg);
 
-        glUseProgram(0);
-        glPopDebugGroup();
-    }
-    break;
+    if (app->runBloomBenchmark)
+    {
+        RunBloomBenchmark(app);
+        app->runBloomBenchmark = false;
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
+    // The uniform, instance and indirect regions written this frame can be reused once these commands complete
+    FenceRingRegion(app->uniformBuff);
+    FenceRingRegion(app->instanceBuff);
+    FenceRingRegion(app->indirectBuff);
 }
 
-void RenderBloom(App* app) {
+void RenderBloom(App* app, GLuint framebuffer) {
     glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Render Bloom");
-#define LOD(x) x
     const vec2 horizontal(1.0, 0.0);
-    const vec2 vertical(1.0, 0.0);
+    const vec2 vertical(0.0, 1.0);
 
-    const float w = app->displaySize.x;
-    const float h = app->displaySize.y;
+    const float w = app->renderSize.x;
+    const float h = app->renderSize.y;
 
     //Copy Bright Pixels
     //app->colorTexHandle == deferred texture resultant
 
-    passBlitBrightPixels(app, app->fboBloom1, vec2(w / 2, h / 2), GL_COLOR_ATTACHMENT0, app->colorTexHandle, LOD(0), app->threshold);
+    passBlitBrightPixels(app, app->bloomFramebuffers[0], vec2(w / 2, h / 2), GL_COLOR_ATTACHMENT0, app->colorTexHandle, 0, app->threshold);
     glBindTexture(GL_TEXTURE_2D, app->rtBright);
     glGenerateMipmap(GL_TEXTURE_2D);
 
-    //Blur
-    passBlur(app, app->fboBloom1, vec2(w / 2, h / 2), GL_COLOR_ATTACHMENT1, app->rtBright, LOD(0), horizontal);
-    passBlur(app, app->fboBloom2, vec2(w / 4, h / 4), GL_COLOR_ATTACHMENT1, app->rtBright, LOD(1), horizontal);
-    passBlur(app, app->fboBloom3, vec2(w / 8, h / 8), GL_COLOR_ATTACHMENT1, app->rtBright, LOD(2), horizontal);
-    passBlur(app, app->fboBloom4, vec2(w / 16, h / 16), GL_COLOR_ATTACHMENT1, app->rtBright, LOD(3), horizontal);
-    passBlur(app, app->fboBloom5, vec2(w / 32, h / 32), GL_COLOR_ATTACHMENT1, app->rtBright, LOD(4), horizontal);
+    //Blur every level of the chain
+    for (u32 level = 0; level < app->bloomChainLevels; ++level)
+    {
+        const f32 scale = (f32)(2 << level);
+        passBlur(app, app->bloomFramebuffers[level], vec2(w / scale, h / scale), GL_COLOR_ATTACHMENT1, app->rtBright, level, horizontal);
+    }
 
-    passBlur(app, app->fboBloom1, vec2(w / 2, h / 2), GL_COLOR_ATTACHMENT0, app->rtBloomH, LOD(0), vertical);
-    passBlur(app, app->fboBloom2, vec2(w / 4, h / 4), GL_COLOR_ATTACHMENT0, app->rtBloomH, LOD(1), vertical);
-    passBlur(app, app->fboBloom3, vec2(w / 8, h / 8), GL_COLOR_ATTACHMENT0, app->rtBloomH, LOD(2), vertical);
-    passBlur(app, app->fboBloom4, vec2(w / 16, h / 16), GL_COLOR_ATTACHMENT0, app->rtBloomH, LOD(3), vertical);
-    passBlur(app, app->fboBloom5, vec2(w / 32, h / 32), GL_COLOR_ATTACHMENT0, app->rtBloomH, LOD(4), vertical);
+    for (u32 level = 0; level < app->bloomChainLevels; ++level)
+    {
+        const f32 scale = (f32)(2 << level);
+        passBlur(app, app->bloomFramebuffers[level], vec2(w / scale, h / scale), GL_COLOR_ATTACHMENT0, app->rtBloomH, level, vertical);
+    }
 
     //Apply Blurred Pixels on top of Original
-    passBloom(app, app->framebufferHandle, GL_COLOR_ATTACHMENT0, app->rtBright, 5);
+    passBloom(app, framebuffer, GL_COLOR_ATTACHMENT0, app->rtBright, app->bloomChainLevels);
 
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
     glBindTexture(GL_TEXTURE_2D, 0);
-#undef LOD
     glPopDebugGroup();
 }
 
@@ -1407,8 +2003,8 @@ void passBlitBrightPixels(App* app, GLuint& fbo, const vec2& size, GLenum attach
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, inputTexture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glUniform1i(glGetUniformLocation(BrightestPixelsProgram.handle, "colorTexture"), 0);
-    glUniform1f(glGetUniformLocation(BrightestPixelsProgram.handle, "threshold"), threshold);
+    glUniform1i(UniformLocation(BrightestPixelsProgram, UNIFORM("colorTexture")), 0);
+    glUniform1f(UniformLocation(BrightestPixelsProgram, UNIFORM("threshold")), threshold);
 
     //DRAW Quad
     glBindVertexArray(app->quadVAO);
@@ -1422,37 +2018,16 @@ void passBlitBrightPixels(App* app, GLuint& fbo, const vec2& size, GLenum attach
 }
 
 void passBlur(App* app, GLuint& fbo, const vec2& size, GLenum attachment, GLuint& inputTexture, int LOD, vec2 orientation) {
-
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glDrawBuffer(attachment);
-    glViewport(0, 0, size.x, size.y);
-
-    glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
 
-    Program& BlurProgram = app->programs[app->blurIdx];
-    glUseProgram(BlurProgram.handle);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, inputTexture);
-    glUniform1i(glGetUniformLocation(BlurProgram.handle, "colorMap"), 0);
-    glUniform2i(glGetUniformLocation(BlurProgram.handle, "direction"), orientation.x, orientation.y);
-    glUniform1i(glGetUniformLocation(BlurProgram.handle, "inputLod"), LOD);
-    glUniform1i(glGetUniformLocation(BlurProgram.handle, "kernelRadius"), app->kernelRadius);
-
-    //DRAW Quad
-    glBindVertexArray(app->quadVAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
-
-    glUseProgram(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    const u32 kernel = GetBlurKernel(app, BlurKernel_Smoothstep, app->kernelRadius);
+    BlurPass(app, kernel, fbo, attachment, ivec2(size), inputTexture, LOD, orientation);
 }
 
 void passBloom(App* app, GLuint& fbo, GLenum attachment, GLuint& inputTexture, int LOD) {
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
     glDrawBuffer(attachment);
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
 
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
@@ -1463,13 +2038,9 @@ void passBloom(App* app, GLuint& fbo, GLenum attachment, GLuint& inputTexture, i
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, inputTexture);
-    glUniform1i(glGetUniformLocation(BloomProgram.handle, "colorMap"), 0);
-    glUniform1i(glGetUniformLocation(BloomProgram.handle, "maxLOD"), LOD);
-    glUniform1f(glGetUniformLocation(BloomProgram.handle, "LOD0"), app->LOD0);
-    glUniform1f(glGetUniformLocation(BloomProgram.handle, "LOD1"), app->LOD1);
-    glUniform1f(glGetUniformLocation(BloomProgram.handle, "LOD2"), app->LOD2);
-    glUniform1f(glGetUniformLocation(BloomProgram.handle, "LOD3"), app->LOD3);
-    glUniform1f(glGetUniformLocation(BloomProgram.handle, "LOD4"), app->LOD4);
+    glUniform1i(UniformLocation(BloomProgram, UNIFORM("colorMap")), 0);
+    glUniform1i(UniformLocation(BloomProgram, UNIFORM("maxLOD")), LOD);
+    glUniform1fv(UniformLocation(BloomProgram, UNIFORM("uIntensity")), BLOOM_MAX_LEVELS, app->bloomIntensity);
 
     //DRAW Quad
     glBindVertexArray(app->quadVAO);
@@ -1480,5 +2051,6 @@ void passBloom(App* app, GLuint& fbo, GLenum attachment, GLuint& inputTexture, i
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glBlendFunc(GL_ONE, GL_ZERO);
+    glDisable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
 }
\ No newline at end of file
@@ -6,9 +6,17 @@
 
 #include "platform.h"
 #include <glad/glad.h>
+#include <unordered_map>
+#include <type_traits>
+#include <functional>
 
-#define MIPMAP_BASE_LEVEL 0
-#define MIPMAP_MAX_LEVEL 4
+#define BLOOM_MAX_LEVELS 8 // BLOOM_MAX_LEVELS in Mode_Bloom
+
+#define MAX_FRAMES_IN_FLIGHT 4
+#define MAX_INSTANCES        16384
+#define MAX_MATERIALS        65536 // 16 bit material ids in the draw keys and the G-buffer
+
+#define BINDING(b) b
 
 
 typedef glm::vec2  vec2;
@@ -31,6 +39,7 @@ struct Texture
 {
     GLuint      handle;
     std::string filepath;
+    GLuint64    bindlessHandle; // resident GL_ARB_bindless_texture handle, 0 until first used
 };
 
 enum Mode
@@ -38,6 +47,7 @@ enum Mode
     /*Mode_TexturedQuad,*/
     Mode_ForwardShading,
     Mode_DeferredShading,
+    Mode_ClusteredForward,
     Mode_BrightestPixels,
     Mode_Blur,
     Mode_Bloom,
@@ -103,34 +113,43 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
-struct Vao
+// Canonical vertex format. Every mesh is converted to it when it is uploaded into the
+// geometry arena, so all meshes can share one vertex array object.
+struct MeshVertex
 {
-    GLuint handle;
-    GLuint programHandle;
+    vec3 position;
+    vec3 normal;
+    vec2 texCoord;
+    vec3 tangent;
+    vec3 bitangent;
 };
 
+// Vertex attribute fed with the index of the instance being drawn (divisor 1), so that
+// draws submitted with a base instance can fetch their own per-instance data
+#define INSTANCE_INDEX_LOCATION 5
+
 struct Submesh
 {
-    VertexBufferLayout vertexBufferLayout;
+    VertexBufferLayout vertexBufferLayout; // layout of the vertices as loaded, before conversion
     std::vector<float> vertices;
     std::vector<u32>   indices;
-    u32                vertexOffset;
-    u32                indexOffset;
+    u32                baseVertex; // first vertex in the geometry arena
+    u32                firstIndex; // first index in the geometry arena
 
-    std::vector<Vao>   vaos;
+    // Local space bounds, computed at load time
+    vec3               aabbMin;
+    vec3               aabbMax;
 };
 
 struct Mesh
 {
     std::vector<Submesh> submeshes;
-    GLuint               vertexBufferHandle;
-    GLuint               indexBufferHandle;
 };
 
 struct Material
 {
     std::string name;
-    vec3        albedo;
+    vec3        albedo = vec3(1.0f); // tints the albedo texture
     vec3        emissive;
     f32         smoothness;
     u32         albedoTextureIdx;
@@ -138,6 +157,8 @@ struct Material
     u32         specularTextureIdx;
     u32         normalsTextureIdx;
     u32         bumpTextureIdx;
+    u32         features;     // ProgramFeature bits its shading needs, NormalMap and ReliefMap follow the textures
+    bool        dirty = true; // changed since its entry of the material buffer was uploaded
 };
 
 struct Model
@@ -146,13 +167,72 @@ struct Model
     std::vector<u32> materialIdx;
 };
 
+// FNV-1a hash. It is constexpr so names known at compile time cost nothing at runtime
+constexpr u32 HashString(const char* str, u32 hash = 2166136261u)
+{
+    return *str ? HashString(str + 1, (hash ^ (u32)(u8)*str) * 16777619u) : hash;
+}
+
+// Forces the hash of a uniform name to be computed at compile time
+#define UNIFORM(name) std::integral_constant<u32, HashString(name)>::value
+
+struct ProgramUniform
+{
+    u32    nameHash;
+    GLint  location;
+    GLenum type;
+    GLint  size;
+};
+
 struct Program
 {
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
     u64                lastWriteTimestamp; // What is this for?
+    u32                fileWatch; // WatchFile id of filepath
+    std::string        defines; // extra preprocessor lines this variant was compiled with
+    bool               compute; // single compute stage instead of vertex + fragment
     VertexShaderLayout vertexInputLayout;
+    std::vector<ProgramUniform> uniforms; // active uniforms and samplers sorted by nameHash, built once at link time
+    u32                buildGeneration; // latest rebuild requested, older ones are dropped
+};
+
+// Optional parts of the material shaders, compiled in with a #define instead of branching at runtime
+enum ProgramFeature
+{
+    ProgramFeature_NormalMap = 1 << 0, // NORMAL_MAP
+    ProgramFeature_ReliefMap = 1 << 1, // RELIEF_MAP
+    ProgramFeature_ConeStep  = 1 << 2, // CONE_STEP_MAPPING, relief marched with the cone map
+};
+
+#define PROGRAM_FEATURE_COUNT     3
+#define PROGRAM_PERMUTATION_COUNT (1 << PROGRAM_FEATURE_COUNT)
+
+// Variants of one program for every combination of ProgramFeature. Each is loaded into app->programs
+// when a material that can draw with it is loaded, so the binary cache and the hot reload cover it
+// like any program and drawing never compiles.
+struct ProgramPermutations
+{
+    std::string filepath;
+    std::string programName;
+    std::string defines;                               // shared by every variant
+    u32         programIdx[PROGRAM_PERMUTATION_COUNT]; // UINT32_MAX until first used
+};
+
+// Replacement of a program being built in the background (program_reload.h)
+struct ProgramBuild
+{
+    u32    id;
+    u32    programIdx;
+    u32    generation;
+    GLuint handle;          // 0 while a worker thread builds it
+    GLuint shaders[2];      // stages the driver is still compiling, with parallel shader compile
+    u64    cacheKey;
+    u64    sourceTimestamp; // write time of the source it was built from
+    bool   cached;          // loaded from the binary cache
+    bool   done;
+    bool   linked;
 };
 
 enum CamMode
@@ -201,8 +281,117 @@ struct Entity
     unsigned int id;
     glm::mat4   worldMatrix;
     u32         modelIndex;
-    u32         localParamsOffset;
-    u32         localParamsSize;
+    bool        dirty = true; // worldMatrix changed since its object data was uploaded
+};
+
+// One submesh of one entity. Draw items are sorted by their key so consecutive draws
+// share as much state as possible:
+//  [63..56] shader variant | [55..40] material | [39..24] geometry | [23..0] depth
+struct DrawItem
+{
+    u64         sortKey;
+    u32         entityIdx;
+    u32         meshIdx;
+    u32         submeshIdx;
+    u32         materialIdx;
+    u32         features; // of the material, selects the shader variant
+};
+
+// Node of the scene bounding volume hierarchy. Leaves hold exactly one entity, so a
+// moved entity only needs its leaf and ancestors refitted.
+struct BVHNode
+{
+    vec3 aabbMin;
+    vec3 aabbMax;
+    i32  parent;
+    i32  left;
+    i32  right;
+    i32  entityIdx; // -1 for inner nodes
+};
+
+struct SceneBVH
+{
+    std::vector<BVHNode> nodes;
+    std::vector<i32>     entityLeaves; // leaf node of every entity
+    i32                  root = -1;
+    f32                  builtCost;    // SAH cost right after the last rebuild
+    u32                  rebuildCount;
+};
+
+// World space boxes as a structure of arrays, padded to a multiple of 8 entries so
+// the SIMD culling loops never need a scalar tail
+struct CullBounds
+{
+    std::vector<f32> centerX, centerY, centerZ;
+    std::vector<f32> extentX, extentY, extentZ;
+    u32              count;
+};
+
+// Consecutive draw items that only differ by entity. Each batch becomes one indirect
+// draw command whose instances are stored contiguously in the instance buffer.
+struct DrawBatch
+{
+    u32 firstItem;
+    u32 instanceCount;
+    u32 baseInstance;
+};
+
+// std430 layout of one entry of the InstanceParams storage buffer
+struct InstanceData
+{
+    u32 objectIdx;
+    u32 materialIdx;
+    u32 batchIdx;   // indirect command of the instance, used by the occlusion culling pass
+    u32 padding;
+};
+
+// std430 layout of one entry of the ObjectParams storage buffer, one per entity
+struct ObjectData
+{
+    glm::mat4 model;
+    glm::mat4 normalMatrix; // inverse transpose of model, mat4 to keep the std430 layout trivial
+    vec4      aabbMin;      // world space bounds of the entity, w unused
+    vec4      aabbMax;
+};
+
+// std140 layout of the GlobalParams block
+struct GlobalParamsHeader
+{
+    vec3 cameraPosition;
+    u32  lightCount;
+    u32  lightCapacity; // entries of each stream of the light buffer
+    u32  padding[3];
+};
+
+// std430 layout of one entry of the MaterialParams storage buffer, indexed with the material of
+// each instance and with the material id of the G-buffer
+struct MaterialData
+{
+    vec4     albedo;        // a: smoothness
+    vec4     emissive;
+    GLuint64 albedoTexture; // bindless handles, 0 without bindless support
+    GLuint64 normalTexture;
+    GLuint64 heightTexture;
+    GLuint64 unused;
+};
+
+// Consecutive batches sharing shader variant and material textures, submitted with a single
+// glMultiDrawElementsIndirect call
+struct DrawBucket
+{
+    u32 firstBatch;
+    u32 batchCount;
+    u32 commandOffset; // relative to the start of the commands of the frame
+};
+
+// Layout expected by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
 };
 
 struct Buffer
@@ -211,7 +400,15 @@ struct Buffer
     GLenum      type;
     u32         size;
     u32         head;
+    u32         end;  //pushes must not go past this offset
     void*       data; //mapped data
+
+    //ring buffer mode: the buffer is split in regions, one per frame in flight
+    u32         regionSize;
+    u32         regionCount;
+    u32         regionIdx;
+    bool        persistent; //mapped once with GL_MAP_PERSISTENT_BIT
+    GLsync      fences[MAX_FRAMES_IN_FLIGHT];
 };
 
 enum LightType
@@ -227,6 +424,140 @@ struct Light
     vec3        color;
     vec3        direction;
     vec3        position;
+    f32         radius = 10.0f; // point lights contribute nothing past it
+    bool        dirty = true; // changed since it was uploaded to the light buffer
+};
+
+// Texture with immutable storage, shared by the holders of the same size, format and mip count
+struct RenderTarget
+{
+    ivec2  size;
+    GLenum format;
+    u32    levels;
+    GLuint handle;
+    u32    generation;   // pool generation it was created in
+    u64    lastUsedFrame;
+    bool   busy;         // held by someone, idle targets can be handed out again or deleted
+};
+
+struct RenderTargetPool
+{
+    std::vector<RenderTarget> targets;
+    u64 frame;
+    u32 generation;     // bumped when the targets are reallocated for a new size
+    u32 reusedCount;    // idle targets handed out again in the frame they were already used
+    u64 bytes;
+};
+
+enum BlurKernelType
+{
+    BlurKernel_Gaussian,
+    BlurKernel_Smoothstep, // smoothstep falloff to 0 at the radius
+    BlurKernel_Custom
+};
+
+// One side of a symmetric separable kernel with neighbouring taps folded into bilinear fetches.
+// Tap 0 is the center, the others are sampled on both sides. Each kernel has its own program
+// with the tables compiled in as constants.
+struct BlurKernel
+{
+    BlurKernelType   type;
+    u32              radius;
+    std::vector<f32> offsets; // in texels
+    std::vector<f32> weights; // normalized over both sides
+    u32              programIdx;
+};
+
+#define FG_MAX_COLOR_ATTACHMENTS 4
+
+// Texture (or any imported GL object) tracked by the frame graph. Transient textures
+// only exist while the passes using them run and get a pooled texture at compile time.
+struct FGResource
+{
+    const char* name;
+    ivec2       size;
+    GLenum      format;
+    bool        imported;
+    GLuint      handle;
+    i32         firstPass; // lifetime over the passes kept this frame, -1 when unused
+    i32         lastPass;
+};
+
+// Every write creates a new version of its resource, passes read versions
+struct FGVersion
+{
+    u32  resource;
+    i32  producer;  // -1 for the contents the resource had when the frame started
+    u32  readCount; // passes still reading it, plus one if it is an output
+    bool output;
+};
+
+struct FGAttachment
+{
+    u32  version;
+    i32  slot;  // color attachment index, -1 for depth
+    bool clear;
+    bool used;  // false when nobody reads what the pass would write to it
+};
+
+struct FGPass
+{
+    const char*                        name;
+    std::function<void(const FGPass&)> execute;
+    std::vector<u32>                   reads;       // versions
+    std::vector<u32>                   writes;      // versions written outside of the framebuffer (images, buffers)
+    std::vector<FGAttachment>          attachments;
+    u32                                refCount;
+    bool                               culled;
+    GLuint                             framebuffer; // bound while execute runs, 0 without attachments
+};
+
+
+struct FGFramebuffer
+{
+    GLuint colors[FG_MAX_COLOR_ATTACHMENTS];
+    GLuint depth;
+    GLuint handle;
+};
+
+#define FG_MAX_TIMED_PASSES 32
+
+// Timestamps around the passes of a frame, read back MAX_FRAMES_IN_FLIGHT frames later
+struct FGTimerFrame
+{
+    GLuint      queries[2 * FG_MAX_TIMED_PASSES];
+    const char* names[FG_MAX_TIMED_PASSES];
+    u32         count;
+};
+
+struct FGPassTiming
+{
+    const char* name;
+    f32         milliseconds;
+};
+
+// Passes and resources are declared again every frame, the framebuffers built over the
+// textures persist. Transient textures come from the render target pool.
+struct FrameGraph
+{
+    std::vector<FGResource>    resources;
+    std::vector<FGVersion>     versions;
+    std::vector<FGPass>        passes;
+    std::vector<FGFramebuffer> framebuffers;
+    RenderTargetPool*          pool;
+
+    // Stats of the last frame
+    u32 passCount;
+    u32 culledPassCount;
+    u32 clearCount;
+    u32 skippedClearCount;  // clears of attachments nobody reads or of culled passes
+    u32 aliasedCount;       // transient textures that reused the memory of an earlier one
+    u64 transientBytes;     // size of the transient textures if each had its own memory
+
+    // GPU time of the kept passes, a few frames old
+    FGTimerFrame              timerFrames[MAX_FRAMES_IN_FLIGHT];
+    u32                       timerFrame;
+    std::vector<FGPassTiming> timings;
 };
 
 
@@ -244,11 +575,17 @@ struct App
     int steps = 200;
     bool normalMap = true;
     bool heightMap = true;
+    bool coneStepMapping = true;    // heightbump is a cone map (cone_map.h)
+    int coneSteps = 16;
+    float reliefLodDistance = 10.0f; // relief steps start dropping beyond this distance
 
     // Loop
     f32  deltaTime;
     bool isRunning;
     bool renderBloom = false;
+    bool computeBloom = true;
+    bool runBloomBenchmark = false;
+    bool tiledLighting = true;
 
     // Input
     Input input;
@@ -260,14 +597,15 @@ struct App
     float threshold = 0.65f;
     int kernelRadius = 8.f;
 
-    float LOD0 = 0.1;
-    float LOD1 = 0.2;
-    float LOD2 = 0.3;
-    float LOD3 = 0.6;
-    float LOD4 = 0.9;
+    //Bloom mip chain, level 0 is half the render size
+    int   bloomLevels = 5;
+    float bloomIntensity[BLOOM_MAX_LEVELS] = { 0.1f, 0.2f, 0.3f, 0.6f, 0.9f, 1.0f, 1.0f, 1.0f };
+    u32   bloomChainLevels;  // levels rtBright and rtBloomH were allocated with
 
     ivec2 displaySize;
     ivec2 displaySizeLastFrame;
+    ivec2 renderSize;          // size of the render targets, lags displaySize while a resize is in progress
+    u32   resizeStableFrames;  // frames displaySize has not changed for
 
     std::vector<Texture>  textures;
     std::vector<Material> materials;
@@ -278,17 +616,61 @@ struct App
     std::vector<Light>    lights;
     std::vector<GameObject> gameObjects;
 
-    // program indices
-    u32 texturedGeometryProgramIdx;
+    // Program binary cache (program_cache.h)
+    bool programCacheEnabled;
+    std::string programCacheDirectory;
+    u32  programCacheHits;
+    u32  programCacheMisses;
+
+    // Programs rebuilt after shaders.glsl changed, swapped in once linked (program_reload.h)
+    std::vector<ProgramBuild> programBuilds;
+    f64                       programReloadLatency; // seconds from the last save to its programs being used
+
+    // Sorted list of draws, rebuilt only when entities, models or materials change
+    std::vector<DrawItem> drawList;
+    bool                  drawListDirty = true; // set by anything changing entities, models or material features
+    u32                   drawListEntityCount;  // entities the list was built for
+    std::vector<DrawBatch> drawBatches;
+
+    // Frustum culling of the draw list, drawVisible is parallel to drawList
+    bool                  frustumCulling = true;
+    SceneBVH              sceneBVH;
+    std::vector<u8>       entityVisible;
+    CullBounds            drawBounds;
+    std::vector<u8>       drawVisible;
+    std::vector<u32>      visibleEntities;  // scratch of CullDrawList, kept to reuse the allocations
+    std::vector<u32>      cullCandidates;   // draw items of the visible entities
+    std::vector<u8>       candidateVisible;
+    u32                   visibleDrawCount;
+
+    std::vector<DrawBucket> drawBuckets;
+    std::vector<DrawElementsIndirectCommand> drawCommands; // CPU copy of the commands, pushed twice for occlusion culling
+
+    // Programs drawing the draw list, indices into programPermutations
+    std::vector<ProgramPermutations> programPermutations;
     u32 ForwardShadingIdx;
+    u32 ForwardShadingBindlessIdx;
+    u32 ForwardClusteredIdx;
+    u32 ForwardClusteredBindlessIdx;
+    u32 DepthPrepassIdx;
     u32 DeferredGeometryIdx;
+    u32 DeferredGeometryBindlessIdx;
+
+    // program indices
+    u32 texturedGeometryProgramIdx;
+    u32 clusterLightsProgramIdx;
+    u32 gBufferDebugIdx;
     u32 DeferredLightingIdx;
+    u32 DeferredLightingTiledIdx;
     u32 blitBrightestPixelsProgramIdx;
-    u32 blurIdx;
     u32 bloomIdx;
+    u32 bloomDownsampleIdx;
+    u32 bloomUpsampleIdx;
+    u32 bloomCompositeIdx;
 
     // texture plane
     u32 whiteTexIdx;
+    u32 blankTexIdx; // plain white, for materials whose albedo is only a color
     
     //texture bump
     u32 albedobump;
@@ -304,9 +686,6 @@ struct App
     Mode mode;
     Modes modes;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programUniformTexture;
-
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
 
@@ -314,30 +693,98 @@ struct App
     Camera cam;
 
     //Buffers
+    u32    framesInFlight = 3;
     Buffer vertexBuff;
     Buffer elementBuff;
     Buffer uniformBuff;
+    Buffer instanceBuff;
+    Buffer indirectBuff;
+    Buffer materialBuff;
+    Buffer objectBuff;
+    Buffer globalParamsBuff;
+
+    //Geometry arena, shared by every mesh
+    Buffer geometryVertexBuff;
+    Buffer geometryIndexBuff;
+    Buffer instanceIndexBuff;
+    GLuint geometryVao;
+    GLuint depthOnlyVao;    // positions and instance indices of the geometry arena
 
     //Uniforms
     glm::mat4 projection;
     glm::mat4 view;
     glm::mat4 modl;
+    f32 zNear = 0.1f;
+    f32 zFar = 1000.0f;
 
     //Uniform buffers parameters
     GLint maxUniformBufferSize;
     GLint uniformBlockAlignment;
-
-    //Global params
-    u32 GlobalParamsOffset;
-    u32 GlobalParamsSize;
-
-    //Framebuffer
-    GLuint framebufferHandle;
-    GLuint fboBloom1;
-    GLuint fboBloom2;
-    GLuint fboBloom3;
-    GLuint fboBloom4;
-    GLuint fboBloom5;
+    GLint storageBlockAlignment;
+
+    //Global params (camera position and light count), only re-uploaded when they change
+    GlobalParamsHeader globalParamsHeader;
+    bool               globalParamsDirty = true;
+
+    //Lights as SoA streams (position and radius, color and type, direction) of lightCapacity vec4s
+    Buffer lightBuff;
+    u32    lightCapacity;
+    std::vector<vec4> lightStreams[3]; // upload scratch of UpdateLightBuffer, one per stream
+    bool   runLightBenchmark = false;
+
+    //Local params, the per-view block (view and projection, shared by every draw)
+    u32 LocalParamsOffset;
+    u32 LocalParamsSize;
+
+    //Bindless textures: the material buffer holds resident handles of the material textures
+    bool bindlessSupported = false;
+    bool bindlessTextures = false;
+
+    //Instance params (object and material index of every instance drawn this frame)
+    u32 InstanceParamsOffset;
+    u32 InstanceParamsSize;
+    u32 InstanceCount;
+
+    //Indirect commands, with occlusion culling a second copy holds the commands of the second phase
+    u32 CommandsOffset;
+    u32 CommandsSize;
+    u32 OcclusionCommandsOffset;
+
+    // Depth only pass before the forward and G-buffer passes, the clustered path always has one
+    bool      depthPrepass = false;
+
+    //Hi-Z occlusion culling. Instances are tested against the previous frame pyramid, the
+    //pyramid is rebuilt from what was drawn and the rejected instances are tested again.
+    bool      occlusionCulling = true;
+    GLuint    hiZTexture;
+    ivec2     hiZSize;
+    u32       hiZLevels;
+    bool      hiZValid;             // the pyramid holds the depth of a previous frame of the same size
+    glm::mat4 hiZViewProjection;    // view projection the pyramid was rendered with
+    u32       hiZProgramIdx;
+    u32       occlusionCullProgramIdx;
+    Buffer    culledInstanceBuff;   // instances that passed the test, one copy per phase
+    Buffer    instanceVisibilityBuff;
+    Buffer    occlusionStatsBuff;   // one slot per frame in flight, read back once its frame completed
+    u32       occlusionStatsStride;
+    u32       occlusionDrawnFirstPhase;
+    u32       occlusionDrawnSecondPhase;
+    u32       occlusionCulled;
+
+    //Clustered forward, light lists of every cluster built on the GPU each frame
+    Buffer    clusterGridBuff;
+    Buffer    clusterLightsBuff;
+    Buffer    clusterCounterBuff;
+
+    //Render passes and targets, declared every frame in Render
+    FrameGraph       frameGraph;
+    RenderTargetPool renderTargets;
+
+    //Separable blur kernels, created on first use
+    std::vector<BlurKernel> blurKernels;
+
+    //Framebuffers of the fragment bloom, one per level of the chain
+    GLuint bloomFramebuffers[BLOOM_MAX_LEVELS];
 
 
     //framebuffer Attachments
@@ -345,8 +792,8 @@ struct App
     GLuint colorTexHandle;
     GLuint normalTexhandle;
     GLuint albedoTexhandle;
-    GLuint depthTexhandle;
-    GLuint positionTexhandle;
+    GLuint materialTexHandle;
+    GLuint debugTexHandle;    // decoded G-buffer channel shown by the debug views
     GLuint rtBright;
     GLuint rtBloomH;
     GLuint normalTexhandle2;
@@ -360,7 +807,7 @@ struct App
     const char* rmodes[5] = { "color","depth","albedo","normals", "position" };
     int selectedmodes = 0;
 
-    const char* rmode[2] = { "Deferred Shading","Forward Shading" };
+    const char* rmode[3] = { "Deferred Shading","Forward Shading","Clustered Forward" };
     int selectedmode = 0;
 
 
@@ -378,7 +825,11 @@ void Update(App* app);
 
 void Render(App* app);
 
-void RenderBloom(App* app);
+void Shutdown(App* app);
+
+// Fragment version of the bloom, adds the blurred bright pixels of colorTexHandle on top of it.
+// framebuffer has it as color attachment 0.
+void RenderBloom(App* app, GLuint framebuffer);
 
 void passBlitBrightPixels(App* app, GLuint& fbo, const vec2& size, GLenum attachment, GLuint& inputTexture, GLint LOD, float threshold);
 
@@ -388,19 +839,80 @@ void passBloom(App* app, GLuint& handle, GLenum attachment, GLuint& inputTexture
 
 void GetTrasform(App* app, glm::mat4 matrix);
 
+// Selects the entity under a point of the viewport, given in [0, 1] with y down
+void PickEntity(App* app, vec2 viewportPosition);
+
 void CreateHierarchy(App* app, GameObject* parent);
 
+Image LoadImage(const char* filename);
+
+void FreeImage(Image image);
+
+GLuint CreateTexture2DFromImage(Image image);
+
+// Compiles the stages and starts linking, without waiting for either. The stages stay attached
+// until FinishProgramFromSource, which waits for the link, logs the errors and deletes them.
+GLuint SubmitProgramFromSource(String programSource, const char* shaderName, const char* defines, bool compute, GLuint shaders[2]);
+
+bool FinishProgramFromSource(GLuint programHandle, GLuint shaders[2], const char* shaderName);
+
+void ReflectProgram(Program& program);
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines);
+
+// Loads the variant without features right away, the others with the materials that use them
+u32 LoadProgramPermutations(App* app, const char* filepath, const char* programName, const char* defines);
+
+// Index in app->programs of the variant with the given ProgramFeature bits. Loads it if no material
+// asked for it, which invalidates references to app->programs.
+u32 GetProgramVariant(App* app, u32 permutationsIdx, u32 features);
+
+// Loads the variants of every permutation set a material with these features can be drawn with,
+// whatever the GUI toggles. Called whenever a material gains features, after the permutation sets.
+void LoadMaterialProgramVariants(App* app, u32 materialFeatures);
+
 u32 LoadTexture2D(App* app, const char* filepath);
 
+GLint UniformLocation(const Program& program, u32 nameHash);
+
 glm::mat4 TransformScale(const vec3& scaleFactors);
 
 glm::mat4 TransformPositionScale(const vec3& pos,const vec3& scaleFactors);
 
 void FrameBufferObject(App* app);
 
-void DeferredGeometryPass(App * app);
+// (Re)allocates the bloom chain for the render size and the configured level count
+void FrameBufferObjectBloom(App* app);
+
+// Levels of the bloom chain, the configured count limited so the last level is at least one texel
+u32 BloomLevelCount(const App* app);
+
+// Reallocates every render target for the current displaySize
+void ResizeRenderTargets(App* app);
+
+void UpdateGlobalParams(App* app);
+
+// Re-uploads the entries of the materials marked dirty, the whole buffer if it has to grow
+void UpdateMaterialBuffer(App* app);
+
+// Sets up the pass state that lives in the program, every time the draw list switches variants
+typedef std::function<void(Program&)> ProgramSetup;
+
+// Binds the variant of permutationsIdx each bucket's material needs. reuseCulling submits the instances
+// the occlusion culling kept earlier this frame instead of culling again, for passes drawing the same
+// geometry twice. depthOnly draws positions only with the variant without features.
+void RenderDrawList(App* app, u32 permutationsIdx, bool reuseCulling = false, bool depthOnly = false, const ProgramSetup& setup = nullptr);
+
+// reuseCulling after a depth prepass, which already culled the draws and leaves the depth test to the caller
+void DeferredGeometryPass(App * app, bool reuseCulling = false);
 
 void DeferredShadingPass(App * app);
 
+// Compute version of the shading pass, lights are culled per 16x16 tile against its depth bounds
+void DeferredShadingTiledPass(App * app);
+
+// Decodes the G-buffer channel selected in the Render Type combo into debugTexHandle
+void DecodeGBufferDebugView(App* app);
+
 
 
@@ -0,0 +1,522 @@
+//
+// file_watcher.cpp : Background thread of the file watcher. The directories and files are shared
+// with WatchFile under a mutex, the changes go to the engine through a single producer / single
+// consumer ring, so draining them never blocks the main thread.
+//
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#define _CRT_SECURE_NO_WARNINGS
+#include <Windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "file_watcher.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define FILE_WATCH_BUFFER_SIZE 4096
+
+typedef std::chrono::steady_clock WatchClock;
+
+struct WatchedDirectory
+{
+    std::string path;
+    bool        opened;
+    bool        polled; // no native notifications, its files are stat'ed
+#if defined(_WIN32)
+    HANDLE      handle;
+    OVERLAPPED  overlapped;
+    DWORD       buffer[FILE_WATCH_BUFFER_SIZE / sizeof(DWORD)]; // FILE_NOTIFY_INFORMATION is DWORD aligned
+#elif defined(__linux__)
+    int         descriptor;
+#endif
+};
+
+struct WatchedFile
+{
+    std::string            path;
+    std::string            name;      // within its directory
+    u32                    directory;
+    u64                    timestamp; // last write seen, for the polling
+    bool                   pending;   // changed, waiting for the writes to settle
+    WatchClock::time_point changedAt;
+};
+
+struct FileChangeQueue
+{
+    FileChange       changes[FILE_WATCH_QUEUE_SIZE];
+    std::atomic<u32> head; // next change to pop, only written by the main thread
+    std::atomic<u32> tail; // next change to push, only written by the watcher thread
+};
+
+struct FileWatcher
+{
+    std::thread                  thread;
+    std::mutex                   mutex;       // guards the directories and files
+    std::condition_variable      wake;        // wakes the thread when it only polls
+    std::deque<WatchedDirectory> directories; // a deque so they never move, the OS writes into them
+    std::deque<WatchedFile>      files;
+    FileChangeQueue              queue;
+    std::atomic<bool>            stop;
+    bool                         running;
+    bool                         native;      // notifications available, directories may still fall back to polling
+    bool                         wakeRequested;
+#if defined(_WIN32)
+    HANDLE                       wakeEvent;
+#elif defined(__linux__)
+    int                          inotify;
+    int                          wakeDescriptor;
+#endif
+};
+
+static FileWatcher Watcher;
+
+static i32 ElapsedMs(WatchClock::time_point from, WatchClock::time_point to)
+{
+    return (i32)std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+}
+
+// Timeouts below zero wait forever
+static i32 EarlierTimeout(i32 timeout, i32 other)
+{
+    return timeout < 0 ? other : glm::min(timeout, other);
+}
+
+static bool PushChange(const FileChange& change)
+{
+    FileChangeQueue& queue = Watcher.queue;
+    const u32 tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) == FILE_WATCH_QUEUE_SIZE)
+        return false;
+
+    queue.changes[tail % FILE_WATCH_QUEUE_SIZE] = change;
+    queue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool PopFileChange(FileChange* change)
+{
+    FileChangeQueue& queue = Watcher.queue;
+    const u32 head = queue.head.load(std::memory_order_relaxed);
+    if (head == queue.tail.load(std::memory_order_acquire))
+        return false;
+
+    *change = queue.changes[head % FILE_WATCH_QUEUE_SIZE];
+    queue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Flags the files of a directory named name, or all of them if name is empty. Called with the mutex held.
+static void MarkChanged(u32 directory, const char* name)
+{
+    for (WatchedFile& file : Watcher.files)
+    {
+        if (file.directory != directory)
+            continue;
+#ifdef _WIN32
+        if (name[0] != '\0' && _stricmp(file.name.c_str(), name) != 0)
+            continue;
+#else
+        if (name[0] != '\0' && file.name != name)
+            continue;
+#endif
+        // Every write restarts the debounce
+        file.pending = true;
+        file.changedAt = WatchClock::now();
+    }
+}
+
+#if defined(_WIN32)
+
+static bool InitNotifications()
+{
+    Watcher.wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    return Watcher.wakeEvent != NULL;
+}
+
+static void ShutdownNotifications()
+{
+    if (Watcher.wakeEvent)
+        CloseHandle(Watcher.wakeEvent);
+    Watcher.wakeEvent = NULL;
+}
+
+static bool IssueRead(WatchedDirectory& directory)
+{
+    return ReadDirectoryChangesW(directory.handle, directory.buffer, sizeof(directory.buffer), FALSE,
+                                 FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME,
+                                 NULL, &directory.overlapped, NULL) != 0;
+}
+
+static void CloseDirectory(WatchedDirectory& directory)
+{
+    // The buffer has to outlive the read, so wait for the cancellation
+    DWORD size = 0;
+    if (CancelIoEx(directory.handle, &directory.overlapped))
+        GetOverlappedResult(directory.handle, &directory.overlapped, &size, TRUE);
+    CloseHandle(directory.handle);
+    CloseHandle(directory.overlapped.hEvent);
+}
+
+static bool OpenDirectory(WatchedDirectory& directory)
+{
+    directory.handle = CreateFileA(directory.path.c_str(), FILE_LIST_DIRECTORY,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                                   FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (directory.handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    directory.overlapped = {};
+    directory.overlapped.hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (!IssueRead(directory))
+    {
+        CloseHandle(directory.handle);
+        CloseHandle(directory.overlapped.hEvent);
+        return false;
+    }
+    return true;
+}
+
+static void WakeWatcher()
+{
+    SetEvent(Watcher.wakeEvent);
+}
+
+static void WaitForNotifications(i32 timeout)
+{
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    u32    directories[MAXIMUM_WAIT_OBJECTS];
+    DWORD  count = 0;
+    handles[count++] = Watcher.wakeEvent;
+    {
+        std::lock_guard<std::mutex> lock(Watcher.mutex);
+        for (u32 i = 0; i < Watcher.directories.size() && count < MAXIMUM_WAIT_OBJECTS; ++i)
+        {
+            const WatchedDirectory& directory = Watcher.directories[i];
+            if (directory.opened && !directory.polled)
+            {
+                handles[count] = directory.overlapped.hEvent;
+                directories[count++] = i;
+            }
+        }
+    }
+
+    const DWORD result = WaitForMultipleObjects(count, handles, FALSE, timeout < 0 ? INFINITE : (DWORD)timeout);
+    if (result <= WAIT_OBJECT_0 || result >= WAIT_OBJECT_0 + count)
+        return;
+
+    // The other signaled directories stay signaled until the next wait
+    std::lock_guard<std::mutex> lock(Watcher.mutex);
+    const u32 index = directories[result - WAIT_OBJECT_0];
+    WatchedDirectory& directory = Watcher.directories[index];
+
+    DWORD size = 0;
+    if (GetOverlappedResult(directory.handle, &directory.overlapped, &size, FALSE))
+    {
+        if (size == 0)
+        {
+            // Too many changes for the buffer, they are lost
+            MarkChanged(index, "");
+        }
+        else
+        {
+            const u8* entry = (const u8*)directory.buffer;
+            for (;;)
+            {
+                const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)entry;
+                if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+                {
+                    char name[MAX_PATH];
+                    const int length = WideCharToMultiByte(CP_UTF8, 0, info->FileName, info->FileNameLength / sizeof(WCHAR),
+                                                           name, sizeof(name) - 1, NULL, NULL);
+                    name[length] = '\0';
+                    if (length > 0)
+                        MarkChanged(index, name);
+                }
+                if (info->NextEntryOffset == 0)
+                    break;
+                entry += info->NextEntryOffset;
+            }
+        }
+    }
+
+    if (!IssueRead(directory))
+    {
+        ELOG("ReadDirectoryChangesW() failed on %s, polling it instead", directory.path.c_str());
+        CloseHandle(directory.handle);
+        CloseHandle(directory.overlapped.hEvent);
+        directory.polled = true;
+    }
+}
+
+#elif defined(__linux__)
+
+static bool InitNotifications()
+{
+    Watcher.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    Watcher.wakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (Watcher.inotify >= 0 && Watcher.wakeDescriptor >= 0)
+        return true;
+
+    if (Watcher.inotify >= 0)
+        close(Watcher.inotify);
+    if (Watcher.wakeDescriptor >= 0)
+        close(Watcher.wakeDescriptor);
+    return false;
+}
+
+static void ShutdownNotifications()
+{
+    close(Watcher.inotify);
+    close(Watcher.wakeDescriptor);
+}
+
+static bool OpenDirectory(WatchedDirectory& directory)
+{
+    // The directory is watched instead of the file, editors often save by renaming a new file over it
+    directory.descriptor = inotify_add_watch(Watcher.inotify, directory.path.c_str(),
+                                             IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO);
+    return directory.descriptor >= 0;
+}
+
+static void CloseDirectory(WatchedDirectory& directory)
+{
+    inotify_rm_watch(Watcher.inotify, directory.descriptor);
+}
+
+static void WakeWatcher()
+{
+    const u64 value = 1;
+    if (write(Watcher.wakeDescriptor, &value, sizeof(value)) < 0)
+        ELOG("Could not wake the file watcher");
+}
+
+static void WaitForNotifications(i32 timeout)
+{
+    pollfd descriptors[2] = { { Watcher.inotify, POLLIN, 0 }, { Watcher.wakeDescriptor, POLLIN, 0 } };
+    if (poll(descriptors, 2, timeout) <= 0)
+        return;
+
+    if (descriptors[1].revents & POLLIN)
+    {
+        u64 value;
+        while (read(Watcher.wakeDescriptor, &value, sizeof(value)) > 0) {}
+    }
+
+    if (descriptors[0].revents & POLLIN)
+    {
+        alignas(inotify_event) char buffer[FILE_WATCH_BUFFER_SIZE];
+        std::lock_guard<std::mutex> lock(Watcher.mutex);
+
+        ssize_t size;
+        while ((size = read(Watcher.inotify, buffer, sizeof(buffer))) > 0)
+        {
+            for (const char* entry = buffer; entry < buffer + size;)
+            {
+                const inotify_event* event = (const inotify_event*)entry;
+                for (u32 i = 0; i < Watcher.directories.size(); ++i)
+                {
+                    const WatchedDirectory& directory = Watcher.directories[i];
+                    const bool overflow = (event->mask & IN_Q_OVERFLOW) != 0;
+                    if (directory.opened && !directory.polled && (overflow || directory.descriptor == event->wd))
+                        MarkChanged(i, overflow || event->len == 0 ? "" : event->name);
+                }
+                entry += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+}
+
+#else
+
+static bool InitNotifications() { return false; }
+static void ShutdownNotifications() {}
+static bool OpenDirectory(WatchedDirectory& directory) { return false; }
+static void CloseDirectory(WatchedDirectory& directory) {}
+static void WakeWatcher() {}
+static void WaitForNotifications(i32 timeout) {}
+
+#endif
+
+static void WatcherMain()
+{
+    WatchClock::time_point lastPoll = WatchClock::now();
+
+    while (!Watcher.stop)
+    {
+        i32 timeout = -1;
+        {
+            std::lock_guard<std::mutex> lock(Watcher.mutex);
+            Watcher.wakeRequested = false;
+
+            for (WatchedDirectory& directory : Watcher.directories)
+            {
+                if (directory.opened)
+                    continue;
+                directory.opened = true;
+                directory.polled = !Watcher.native || !OpenDirectory(directory);
+                if (directory.polled && Watcher.native)
+                    ELOG("Could not watch directory %s, polling it instead", directory.path.c_str());
+            }
+
+            const WatchClock::time_point now = WatchClock::now();
+
+            bool polling = false;
+            for (const WatchedDirectory& directory : Watcher.directories)
+                polling |= directory.polled;
+
+            if (polling)
+            {
+                if (ElapsedMs(lastPoll, now) >= FILE_WATCH_POLL_MS)
+                {
+                    lastPoll = now;
+                    for (WatchedFile& file : Watcher.files)
+                    {
+                        if (!Watcher.directories[file.directory].polled)
+                            continue;
+                        const u64 timestamp = GetFileLastWriteTimestamp(file.path.c_str());
+                        if (timestamp != file.timestamp)
+                        {
+                            file.timestamp = timestamp;
+                            file.pending = true;
+                            file.changedAt = now;
+                        }
+                    }
+                }
+                timeout = FILE_WATCH_POLL_MS - ElapsedMs(lastPoll, now);
+            }
+
+            // Changes are only posted once the file has been quiet for a while, a save usually
+            // comes as several writes and renames
+            for (u32 i = 0; i < Watcher.files.size(); ++i)
+            {
+                WatchedFile& file = Watcher.files[i];
+                if (!file.pending)
+                    continue;
+
+                const i32 quiet = ElapsedMs(file.changedAt, now);
+                if (quiet < FILE_WATCH_DEBOUNCE_MS)
+                {
+                    timeout = EarlierTimeout(timeout, FILE_WATCH_DEBOUNCE_MS - quiet);
+                    continue;
+                }
+
+                const FileChange change = { i, GetFileLastWriteTimestamp(file.path.c_str()) };
+                if (PushChange(change))
+                {
+                    file.timestamp = change.timestamp;
+                    file.pending = false;
+                }
+                else
+                {
+                    // Full, retried once the engine drained it
+                    timeout = EarlierTimeout(timeout, FILE_WATCH_DEBOUNCE_MS);
+                }
+            }
+        }
+
+        if (Watcher.native)
+        {
+            WaitForNotifications(timeout);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(Watcher.mutex);
+            auto woken = []() { return Watcher.wakeRequested || Watcher.stop; };
+            if (timeout < 0)
+                Watcher.wake.wait(lock, woken);
+            else
+                Watcher.wake.wait_for(lock, std::chrono::milliseconds(timeout), woken);
+        }
+    }
+}
+
+static void Wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(Watcher.mutex);
+        Watcher.wakeRequested = true;
+    }
+
+    if (Watcher.native)
+        WakeWatcher();
+    else
+        Watcher.wake.notify_one();
+}
+
+u32 WatchFile(const char* filepath)
+{
+    u32 watch = 0;
+    {
+        std::lock_guard<std::mutex> lock(Watcher.mutex);
+        for (u32 i = 0; i < Watcher.files.size(); ++i)
+            if (Watcher.files[i].path == filepath)
+                return i;
+
+        const std::string path = filepath;
+        const size_t separator = path.find_last_of("/\\");
+        const std::string directoryPath = separator == std::string::npos ? "." : separator == 0 ? "/" : path.substr(0, separator);
+
+        u32 directory = 0;
+        while (directory < Watcher.directories.size() && Watcher.directories[directory].path != directoryPath)
+            ++directory;
+        if (directory == Watcher.directories.size())
+        {
+            Watcher.directories.emplace_back();
+            Watcher.directories.back().path = directoryPath;
+        }
+
+        WatchedFile file = {};
+        file.path = path;
+        file.name = separator == std::string::npos ? path : path.substr(separator + 1);
+        file.directory = directory;
+        file.timestamp = GetFileLastWriteTimestamp(filepath);
+        Watcher.files.push_back(file);
+        watch = Watcher.files.size() - 1;
+    }
+
+    if (!Watcher.running)
+    {
+        Watcher.native = InitNotifications();
+        Watcher.stop = false;
+        Watcher.thread = std::thread(WatcherMain);
+        Watcher.running = true;
+        ILOG("File watcher: %s", Watcher.native ? "native notifications" : "polling");
+    }
+    else
+    {
+        Wake();
+    }
+
+    return watch;
+}
+
+void ShutdownFileWatcher()
+{
+    if (!Watcher.running)
+        return;
+
+    Watcher.stop = true;
+    Wake();
+    Watcher.thread.join();
+    Watcher.running = false;
+
+    for (WatchedDirectory& directory : Watcher.directories)
+        if (directory.opened && !directory.polled)
+            CloseDirectory(directory);
+    if (Watcher.native)
+        ShutdownNotifications();
+
+    Watcher.directories.clear();
+    Watcher.files.clear();
+}
@@ -0,0 +1,37 @@
+//
+// file_watcher.h : File change notifications of the platform layer. A background thread listens to
+// the directories of the watched files (inotify on Linux, ReadDirectoryChangesW on Windows, stat
+// polling where neither is available), waits until a file stops changing and then posts a single
+// change for it to a lock-free queue the engine drains once per frame.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define FILE_WATCH_QUEUE_SIZE  64
+#define FILE_WATCH_DEBOUNCE_MS 50  // quiet time after the last write before a change is posted
+#define FILE_WATCH_POLL_MS     250 // stat interval of the files without native notifications
+
+struct FileChange
+{
+    u32 watch;     // id returned by WatchFile
+    u64 timestamp; // GetFileLastWriteTimestamp of the file once it stopped changing
+};
+
+/**
+ * Starts watching a file for modifications, starting the watcher thread the first time.
+ * Watching the same path again returns the same id. The file does not need to exist yet.
+ */
+u32 WatchFile(const char* filepath);
+
+/**
+ * Pops the oldest pending change, returns false once there are none. Only to be called from
+ * the main thread, it never touches the file system.
+ */
+bool PopFileChange(FileChange* change);
+
+/**
+ * Stops the watcher thread and releases the watches.
+ */
+void ShutdownFileWatcher();
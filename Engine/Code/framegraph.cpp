@@ -0,0 +1,396 @@
+#include "framegraph.h"
+#include "render_targets.h"
+
+static u32 AddVersion(FrameGraph& fg, u32 resource, i32 producer)
+{
+    FGVersion version = {};
+    version.resource = resource;
+    version.producer = producer;
+    fg.versions.push_back(version);
+    return fg.versions.size() - 1;
+}
+
+static u32 AddResource(FrameGraph& fg, const char* name, GLuint handle, ivec2 size, GLenum format, bool imported)
+{
+    FGResource resource = {};
+    resource.name = name;
+    resource.size = size;
+    resource.format = format;
+    resource.imported = imported;
+    resource.handle = handle;
+    fg.resources.push_back(resource);
+    return AddVersion(fg, fg.resources.size() - 1, -1);
+}
+
+static u32 AddAttachment(FrameGraph& fg, u32 pass, u32 version, i32 slot, bool clear)
+{
+    if (!clear)
+        FGRead(fg, pass, version);
+
+    FGAttachment attachment = {};
+    attachment.version = AddVersion(fg, fg.versions[version].resource, pass);
+    attachment.slot = slot;
+    attachment.clear = clear;
+    fg.passes[pass].attachments.push_back(attachment);
+    return attachment.version;
+}
+
+void FGBegin(FrameGraph& fg)
+{
+    fg.resources.clear();
+    fg.versions.clear();
+    fg.passes.clear();
+}
+
+u32 FGImport(FrameGraph& fg, const char* name, GLuint handle, ivec2 size, GLenum format)
+{
+    return AddResource(fg, name, handle, size, format, true);
+}
+
+u32 FGCreateTexture(FrameGraph& fg, const char* name, ivec2 size, GLenum format)
+{
+    return AddResource(fg, name, 0, glm::max(size, ivec2(1)), format, false);
+}
+
+u32 FGAddPass(FrameGraph& fg, const char* name, std::function<void(const FGPass&)> execute)
+{
+    FGPass pass = {};
+    pass.name = name;
+    pass.execute = std::move(execute);
+    fg.passes.push_back(std::move(pass));
+    return fg.passes.size() - 1;
+}
+
+void FGRead(FrameGraph& fg, u32 pass, u32 version)
+{
+    fg.passes[pass].reads.push_back(version);
+}
+
+u32 FGWrite(FrameGraph& fg, u32 pass, u32 version)
+{
+    const u32 written = AddVersion(fg, fg.versions[version].resource, pass);
+    fg.passes[pass].writes.push_back(written);
+    return written;
+}
+
+u32 FGWriteColor(FrameGraph& fg, u32 pass, u32 version, u32 slot, bool clear)
+{
+    ASSERT(slot < FG_MAX_COLOR_ATTACHMENTS, "Color attachment slot out of range");
+    return AddAttachment(fg, pass, version, slot, clear);
+}
+
+u32 FGWriteDepth(FrameGraph& fg, u32 pass, u32 version, bool clear)
+{
+    return AddAttachment(fg, pass, version, -1, clear);
+}
+
+void FGReadDepth(FrameGraph& fg, u32 pass, u32 version)
+{
+    FGRead(fg, pass, version);
+
+    FGAttachment attachment = {};
+    attachment.version = version;
+    attachment.slot = -1;
+    fg.passes[pass].attachments.push_back(attachment);
+}
+
+void FGSetOutput(FrameGraph& fg, u32 version)
+{
+    fg.versions[version].output = true;
+}
+
+void FGCompile(FrameGraph& fg)
+{
+    // Versions count the passes reading them, passes the versions they produce
+    for (FGVersion& version : fg.versions)
+        version.readCount = version.output ? 1 : 0;
+    for (FGPass& pass : fg.passes)
+    {
+        pass.refCount = 0;
+        pass.culled = false;
+        for (u32 read : pass.reads)
+            fg.versions[read].readCount++;
+    }
+    for (const FGVersion& version : fg.versions)
+        if (version.producer >= 0)
+            fg.passes[version.producer].refCount++;
+
+    // A pass is culled once none of its versions are read, which may leave the versions it read unread in turn.
+    // Passes writing nothing are kept, whatever they do is a side effect the graph can't see.
+    std::vector<u32> unread;
+    for (u32 i = 0; i < fg.versions.size(); ++i)
+        if (fg.versions[i].readCount == 0 && fg.versions[i].producer >= 0)
+            unread.push_back(i);
+
+    while (!unread.empty())
+    {
+        FGPass& producer = fg.passes[fg.versions[unread.back()].producer];
+        unread.pop_back();
+
+        if (--producer.refCount > 0)
+            continue;
+
+        producer.culled = true;
+        for (u32 read : producer.reads)
+        {
+            FGVersion& dependency = fg.versions[read];
+            if (--dependency.readCount == 0 && dependency.producer >= 0)
+                unread.push_back(read);
+        }
+    }
+
+    // Color targets nobody reads are left out of the framebuffer, the depth one is needed for testing
+    fg.passCount = fg.passes.size();
+    fg.culledPassCount = 0;
+    fg.clearCount = 0;
+    fg.skippedClearCount = 0;
+    for (FGPass& pass : fg.passes)
+    {
+        if (pass.culled)
+            fg.culledPassCount++;
+
+        for (FGAttachment& attachment : pass.attachments)
+        {
+            attachment.used = !pass.culled && (attachment.slot < 0 || fg.versions[attachment.version].readCount > 0);
+            if (attachment.clear)
+                attachment.used ? fg.clearCount++ : fg.skippedClearCount++;
+        }
+    }
+
+    // Lifetimes over the kept passes
+    for (FGResource& resource : fg.resources)
+    {
+        resource.firstPass = -1;
+        resource.lastPass = -1;
+        if (!resource.imported)
+            resource.handle = 0;
+    }
+
+    auto touch = [&fg](u32 version, i32 passIdx) {
+        FGResource& resource = fg.resources[fg.versions[version].resource];
+        if (resource.firstPass < 0)
+            resource.firstPass = passIdx;
+        resource.lastPass = passIdx;
+    };
+
+    for (i32 i = 0; i < (i32)fg.passes.size(); ++i)
+    {
+        const FGPass& pass = fg.passes[i];
+        if (pass.culled)
+            continue;
+
+        for (u32 read : pass.reads)
+            touch(read, i);
+        for (u32 write : pass.writes)
+            touch(write, i);
+        for (const FGAttachment& attachment : pass.attachments)
+            if (attachment.used)
+                touch(attachment.version, i);
+    }
+
+    // Transient textures get a pooled one when their lifetime starts and give it back when it ends,
+    // so a later texture of the same size and format can reuse it within the frame
+    BeginRenderTargetFrame(*fg.pool);
+
+    fg.transientBytes = 0;
+    for (i32 i = 0; i < (i32)fg.passes.size(); ++i)
+    {
+        for (FGResource& resource : fg.resources)
+        {
+            if (resource.imported || resource.firstPass != i)
+                continue;
+
+            resource.handle = AcquireRenderTarget(*fg.pool, resource.size, resource.format);
+            fg.transientBytes += RenderTargetBytes(resource.size, resource.format);
+        }
+
+        for (const FGResource& resource : fg.resources)
+        {
+            if (resource.imported || resource.lastPass != i)
+                continue;
+
+            GLuint handle = resource.handle;
+            ReleaseRenderTarget(*fg.pool, handle);
+        }
+    }
+    fg.aliasedCount = fg.pool->reusedCount;
+
+    if (TrimRenderTargets(*fg.pool))
+        FGReleaseFramebuffers(fg);
+}
+
+static GLuint GetFramebuffer(FrameGraph& fg, const GLuint* colors, GLuint depth)
+{
+    for (const FGFramebuffer& framebuffer : fg.framebuffers)
+        if (framebuffer.depth == depth && memcmp(framebuffer.colors, colors, sizeof(framebuffer.colors)) == 0)
+            return framebuffer.handle;
+
+    FGFramebuffer framebuffer = {};
+    memcpy(framebuffer.colors, colors, sizeof(framebuffer.colors));
+    framebuffer.depth = depth;
+
+    glGenFramebuffers(1, &framebuffer.handle);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.handle);
+    for (u32 slot = 0; slot < FG_MAX_COLOR_ATTACHMENTS; ++slot)
+        if (colors[slot] != 0)
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + slot, colors[slot], 0);
+    if (depth != 0)
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0);
+
+    //check errors
+    GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+    {
+        switch (framebufferStatus)
+        {
+            case GL_FRAMEBUFFER_UNDEFINED:                                  ELOG("GL_FRAMEBUFFER_UNDEFINED"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:                      ELOG("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:              ELOG("GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"); break;
+            case GL_FRAMEBUFFER_UNSUPPORTED:                                ELOG("GL_FRAMEBUFFER_UNSUPPORTED"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:                     ELOG("GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"); break;
+            case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:                   ELOG("GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"); break;
+            default: ELOG("Unknown framebuffer status error");
+        }
+    }
+
+    fg.framebuffers.push_back(framebuffer);
+    return framebuffer.handle;
+}
+
+// Binds the used attachments of the pass and clears the ones it asked to clear
+static void BeginRenderPass(FrameGraph& fg, FGPass& pass)
+{
+    GLuint colors[FG_MAX_COLOR_ATTACHMENTS] = {};
+    GLuint depth = 0;
+    ivec2 size(0);
+    for (const FGAttachment& attachment : pass.attachments)
+    {
+        if (!attachment.used)
+            continue;
+
+        const FGResource& resource = fg.resources[fg.versions[attachment.version].resource];
+        if (attachment.slot < 0)
+            depth = resource.handle;
+        else
+            colors[attachment.slot] = resource.handle;
+        size = resource.size;
+    }
+
+    pass.framebuffer = GetFramebuffer(fg, colors, depth);
+    glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+
+    // Unused slots keep their location but are not written
+    GLenum drawbuffers[FG_MAX_COLOR_ATTACHMENTS];
+    u32 drawbufferCount = 0;
+    for (u32 slot = 0; slot < FG_MAX_COLOR_ATTACHMENTS; ++slot)
+    {
+        drawbuffers[slot] = colors[slot] != 0 ? GL_COLOR_ATTACHMENT0 + slot : GL_NONE;
+        if (colors[slot] != 0)
+            drawbufferCount = slot + 1;
+    }
+    if (drawbufferCount > 0)
+        glDrawBuffers(drawbufferCount, drawbuffers);
+    else
+        glDrawBuffer(GL_NONE);
+
+    glViewport(0, 0, size.x, size.y);
+
+    const f32 clearColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const u32 clearInteger[] = { 0, 0, 0, 0 };
+    const f32 clearDepth = 1.0f;
+    for (const FGAttachment& attachment : pass.attachments)
+    {
+        if (!attachment.used || !attachment.clear)
+            continue;
+
+        if (attachment.slot < 0)
+        {
+            glDepthMask(GL_TRUE);
+            glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+        }
+        else if (fg.resources[fg.versions[attachment.version].resource].format == GL_R16UI)
+        {
+            // Float clears of integer targets are undefined
+            glClearBufferuiv(GL_COLOR, attachment.slot, clearInteger);
+        }
+        else
+        {
+            glClearBufferfv(GL_COLOR, attachment.slot, clearColor);
+        }
+    }
+}
+
+// The timestamps of this slot were written MAX_FRAMES_IN_FLIGHT frames ago, they are only read once
+// all of them are available so the CPU never waits for the GPU
+static void ReadPassTimings(FrameGraph& fg, FGTimerFrame& frame)
+{
+    if (frame.count == 0)
+        return;
+
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[2 * frame.count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    fg.timings.clear();
+    for (u32 i = 0; i < frame.count; ++i)
+    {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[2 * i], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+        fg.timings.push_back({ frame.names[i], (f32)((end - begin) / 1e6) });
+    }
+}
+
+void FGExecute(FrameGraph& fg)
+{
+    FGTimerFrame& timer = fg.timerFrames[fg.timerFrame++ % MAX_FRAMES_IN_FLIGHT];
+    if (timer.queries[0] == 0)
+        glGenQueries(ARRAY_COUNT(timer.queries), timer.queries);
+
+    ReadPassTimings(fg, timer);
+    timer.count = 0;
+
+    for (FGPass& pass : fg.passes)
+    {
+        if (pass.culled)
+            continue;
+
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, pass.name);
+
+        // Timestamps instead of elapsed time queries, which benchmarks run inside passes use
+        const bool timed = timer.count < FG_MAX_TIMED_PASSES;
+        if (timed)
+            glQueryCounter(timer.queries[2 * timer.count], GL_TIMESTAMP);
+
+        pass.framebuffer = 0;
+        if (!pass.attachments.empty())
+            BeginRenderPass(fg, pass);
+
+        pass.execute(pass);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (timed)
+        {
+            glQueryCounter(timer.queries[2 * timer.count + 1], GL_TIMESTAMP);
+            timer.names[timer.count++] = pass.name;
+        }
+
+        glPopDebugGroup();
+    }
+}
+
+GLuint FGTexture(const FrameGraph& fg, u32 version)
+{
+    return fg.resources[fg.versions[version].resource].handle;
+}
+
+void FGReleaseFramebuffers(FrameGraph& fg)
+{
+    for (const FGFramebuffer& framebuffer : fg.framebuffers)
+        glDeleteFramebuffers(1, &framebuffer.handle);
+    fg.framebuffers.clear();
+}
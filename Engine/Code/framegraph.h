@@ -0,0 +1,51 @@
+//
+// framegraph.h: Render passes declared with the textures they read and write. Passes whose
+// results nobody reads are culled, clears of targets nobody reads are skipped, and transient
+// textures of the same size and format share memory when their lifetimes don't overlap.
+//
+// Resources are referred to by version: importing or creating a texture returns its first
+// version, every write returns a new one and passes read the version they depend on.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Drops the passes and resources of the previous frame
+void FGBegin(FrameGraph& fg);
+
+// Texture (or buffer, with no size or format) owned outside of the graph
+u32 FGImport(FrameGraph& fg, const char* name, GLuint handle, ivec2 size = ivec2(0), GLenum format = GL_NONE);
+
+// Texture only alive during the passes that use it, format must be a sized internal format
+u32 FGCreateTexture(FrameGraph& fg, const char* name, ivec2 size, GLenum format);
+
+u32 FGAddPass(FrameGraph& fg, const char* name, std::function<void(const FGPass&)> execute);
+
+void FGRead(FrameGraph& fg, u32 pass, u32 version);
+
+// Write through images or storage buffers, the whole resource is assumed overwritten
+u32 FGWrite(FrameGraph& fg, u32 pass, u32 version);
+
+// Render target writes. Without a clear the pass draws over the previous contents, so it also reads them.
+u32 FGWriteColor(FrameGraph& fg, u32 pass, u32 version, u32 slot, bool clear);
+
+u32 FGWriteDepth(FrameGraph& fg, u32 pass, u32 version, bool clear);
+
+// Depth attachment only tested against, with depth writes disabled by the pass
+void FGReadDepth(FrameGraph& fg, u32 pass, u32 version);
+
+// Marks a version as a result of the frame, everything it doesn't depend on is culled
+void FGSetOutput(FrameGraph& fg, u32 version);
+
+// Culls the passes, computes the lifetimes and assigns pooled textures to the transient ones
+void FGCompile(FrameGraph& fg);
+
+// Runs the kept passes in declaration order
+void FGExecute(FrameGraph& fg);
+
+// Texture of a version, only valid after FGCompile. 0 for transient textures nobody uses.
+GLuint FGTexture(const FrameGraph& fg, u32 version);
+
+// Deletes the cached framebuffers, needed when imported textures are recreated
+void FGReleaseFramebuffers(FrameGraph& fg);
@@ -0,0 +1,52 @@
+#include "gl_extensions.h"
+
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = NULL;
+PFNGLGETTEXTUREHANDLEARBPROC glad_glGetTextureHandleARB = NULL;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC glad_glMakeTextureHandleResidentARB = NULL;
+PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glad_glMakeTextureHandleNonResidentARB = NULL;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = NULL;
+
+OpenGLExtensions GLExt = {};
+
+bool HasGLExtension(const OpenGLInfo& info, const char* name)
+{
+    for (u32 i = 0; i < info.GLExtensions.size(); ++i)
+        if (info.GLExtensions[i] == name)
+            return true;
+    return false;
+}
+
+void LoadGLExtensions(const OpenGLInfo& info)
+{
+    GLExt = {};
+
+    // Buffer storage is core since 4.4, otherwise we need the ARB extension
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) || HasGLExtension(info, "GL_ARB_buffer_storage"))
+    {
+        glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)GetGLProcAddress("glBufferStorage");
+        GLExt.bufferStorage = glad_glBufferStorage != NULL;
+    }
+
+    // Bindless textures never made it into core
+    if (HasGLExtension(info, "GL_ARB_bindless_texture"))
+    {
+        glad_glGetTextureHandleARB = (PFNGLGETTEXTUREHANDLEARBPROC)GetGLProcAddress("glGetTextureHandleARB");
+        glad_glMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)GetGLProcAddress("glMakeTextureHandleResidentARB");
+        glad_glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)GetGLProcAddress("glMakeTextureHandleNonResidentARB");
+        GLExt.bindlessTexture = glad_glGetTextureHandleARB != NULL &&
+                                glad_glMakeTextureHandleResidentARB != NULL &&
+                                glad_glMakeTextureHandleNonResidentARB != NULL;
+    }
+
+    // Both versions share the tokens, only the entry point name differs
+    if (HasGLExtension(info, "GL_KHR_parallel_shader_compile"))
+        glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetGLProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (HasGLExtension(info, "GL_ARB_parallel_shader_compile"))
+        glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetGLProcAddress("glMaxShaderCompilerThreadsARB");
+    GLExt.parallelShaderCompile = glad_glMaxShaderCompilerThreadsKHR != NULL;
+
+    ILOG("OpenGL extensions: buffer storage %s, bindless texture %s, parallel shader compile %s",
+         GLExt.bufferStorage ? "yes" : "no",
+         GLExt.bindlessTexture ? "yes" : "no",
+         GLExt.parallelShaderCompile ? "yes" : "no");
+}
@@ -0,0 +1,145 @@
+#include "lights.h"
+#include "buffer_management.h"
+#include <random>
+
+#define LIGHT_STREAM_COUNT 3
+
+void UpdateLightBuffer(App* app)
+{
+    const u32 lightCount = app->lights.size();
+
+    if (app->lightBuff.handle == 0 || lightCount > app->lightCapacity)
+    {
+        u32 capacity = glm::max(app->lightCapacity, 64u);
+        while (capacity < lightCount)
+            capacity *= 2;
+
+        if (app->lightBuff.handle != 0)
+            glDeleteBuffers(1, &app->lightBuff.handle);
+
+        app->lightBuff = CreateBuffer(LIGHT_STREAM_COUNT * capacity * sizeof(vec4), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+        app->lightCapacity = capacity;
+
+        // The streams moved, so every light is uploaded again
+        for (Light& light : app->lights)
+            light.dirty = true;
+    }
+
+    std::vector<vec4>& positions = app->lightStreams[0];
+    std::vector<vec4>& colors = app->lightStreams[1];
+    std::vector<vec4>& directions = app->lightStreams[2];
+
+    // Consecutive dirty lights are uploaded with one update per stream
+    u32 first = 0;
+    while (first < lightCount)
+    {
+        if (!app->lights[first].dirty)
+        {
+            ++first;
+            continue;
+        }
+
+        u32 last = first;
+        while (last < lightCount && app->lights[last].dirty)
+            ++last;
+
+        positions.clear();
+        colors.clear();
+        directions.clear();
+        for (u32 i = first; i < last; ++i)
+        {
+            Light& light = app->lights[i];
+            positions.push_back(vec4(light.position, light.radius));
+            colors.push_back(vec4(light.color, (f32)light.type));
+            directions.push_back(vec4(light.direction, 0.0f));
+            light.dirty = false;
+        }
+
+        const u32 size = (last - first) * sizeof(vec4);
+        const u32 streamSize = app->lightCapacity * sizeof(vec4);
+        UpdateData(app->lightBuff, first * sizeof(vec4), positions.data(), size);
+        UpdateData(app->lightBuff, streamSize + first * sizeof(vec4), colors.data(), size);
+        UpdateData(app->lightBuff, 2 * streamSize + first * sizeof(vec4), directions.data(), size);
+
+        first = last;
+    }
+}
+
+void RunLightBenchmark(App* app)
+{
+    const u32 counts[] = { 16, 256, 4096, 65536 };
+    const u32 iterations = 5;
+
+    // Evaluating every light for every pixel stops being measurable past this
+    const u32 maxFullscreenLights = 4096;
+
+    vec3 boundsMin(-10.0f), boundsMax(10.0f);
+    if (app->sceneBVH.root >= 0)
+    {
+        boundsMin = app->sceneBVH.nodes[app->sceneBVH.root].aabbMin;
+        boundsMax = app->sceneBVH.nodes[app->sceneBVH.root].aabbMax;
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> x(boundsMin.x, boundsMax.x);
+    std::uniform_real_distribution<f32> y(boundsMin.y, boundsMax.y);
+    std::uniform_real_distribution<f32> z(boundsMin.z, boundsMax.z);
+    std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+    const std::vector<Light> sceneLights = app->lights;
+    const u32 sceneCapacity = app->lightCapacity;
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    // Average GPU time of the pass, the result is waited for so runs do not overlap
+    auto timePass = [&](void (*pass)(App*)) {
+        u64 total = 0;
+        for (u32 it = 0; it < iterations; ++it)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            pass(app);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            total += elapsed;
+        }
+        return (f64)total / iterations / 1e6;
+    };
+
+    for (u32 c = 0; c < ARRAY_COUNT(counts); ++c)
+    {
+        app->lights.resize(counts[c]);
+        for (Light& light : app->lights)
+        {
+            light.type = LightType_Point;
+            light.position = vec3(x(rng), y(rng), z(rng));
+            light.color = vec3(unit(rng), unit(rng), unit(rng));
+            light.direction = vec3(0.0f);
+            light.radius = 1.0f + 2.0f * unit(rng);
+            light.dirty = true;
+        }
+        UpdateGlobalParams(app);
+
+        const f64 tiled = timePass(DeferredShadingTiledPass);
+        if (counts[c] <= maxFullscreenLights)
+        {
+            const f64 fullscreen = timePass(DeferredShadingPass);
+            ILOG("Lighting %5u lights: fullscreen %8.3f ms, tiled %8.3f ms (x%.1f)", counts[c], fullscreen, tiled, fullscreen / tiled);
+        }
+        else
+        {
+            ILOG("Lighting %5u lights: fullscreen skipped, tiled %8.3f ms", counts[c], tiled);
+        }
+    }
+
+    glDeleteQueries(1, &query);
+
+    // Back to the buffer the scene had instead of keeping room for 65536 lights
+    glDeleteBuffers(1, &app->lightBuff.handle);
+    app->lightBuff = {};
+    app->lightCapacity = sceneCapacity;
+    app->lights = sceneLights;
+    UpdateGlobalParams(app);
+}
@@ -0,0 +1,16 @@
+//
+// lights.h: Light storage. Lights live in a shader storage buffer as three SoA streams of
+// vec4 (position and radius, color and type, direction), so culling passes only read the
+// first one and the count is bounded by memory instead of the uniform block size.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Uploads the lights marked dirty, growing the buffer when the scene has more lights than it holds
+void UpdateLightBuffer(App* app);
+
+// Times the deferred lighting pass, fullscreen and tiled, with 16, 256, 4096 and 65536 random
+// point lights and logs the results. Needs the G-buffer of the current frame.
+void RunLightBenchmark(App* app);
@@ -0,0 +1,128 @@
+#include "occlusion.h"
+#include "gl_extensions.h"
+#include "render_targets.h"
+
+#define HIZ_TEXTURE_UNIT 7 // away from the units used by the material textures
+
+void CreateHiZPyramid(App* app)
+{
+    if (app->hiZTexture != 0)
+        ReleaseRenderTarget(app->renderTargets, app->hiZTexture);
+
+    app->hiZSize = glm::max(app->renderSize, ivec2(1));
+    app->hiZLevels = 1 + (u32)floorf(log2f((f32)glm::max(app->hiZSize.x, app->hiZSize.y)));
+
+    app->hiZTexture = AcquireRenderTarget(app->renderTargets, app->hiZSize, GL_R32F, app->hiZLevels);
+    glBindTexture(GL_TEXTURE_2D, app->hiZTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    app->hiZValid = false;
+}
+
+void BuildHiZPyramid(App* app)
+{
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, "Hi-Z Pyramid");
+
+    Program& program = app->programs[app->hiZProgramIdx];
+    glUseProgram(program.handle);
+    glUniform1i(UniformLocation(program, UNIFORM("uDepth")), HIZ_TEXTURE_UNIT);
+
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+    glActiveTexture(GL_TEXTURE0);
+
+    const GLint uLevel = UniformLocation(program, UNIFORM("uLevel"));
+    for (u32 level = 0; level < app->hiZLevels; ++level)
+    {
+        const ivec2 size = glm::max(ivec2(app->hiZSize.x >> level, app->hiZSize.y >> level), ivec2(1));
+
+        // Level 0 copies the depth buffer, every other level reduces the one above it
+        glUniform1i(uLevel, level);
+        if (level > 0)
+            glBindImageTexture(0, app->hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, app->hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    app->hiZViewProjection = app->projection * app->view;
+    app->hiZValid = true;
+
+    glPopDebugGroup();
+}
+
+void BeginOcclusionStats(App* app)
+{
+    // The indirect region of this frame was fenced, so the frame that last wrote this slot is done
+    const u32 slotOffset = app->indirectBuff.regionIdx * app->occlusionStatsStride;
+
+    Buffer& stats = app->occlusionStatsBuff;
+    if (stats.persistent)
+    {
+        // Coherent mapping, no GL call touches the buffer while other frames still use it
+        u32* counters = (u32*)((u8*)stats.data + slotOffset);
+        app->occlusionDrawnFirstPhase = counters[0];
+        app->occlusionDrawnSecondPhase = counters[1];
+        app->occlusionCulled = counters[2];
+        memset(counters, 0, 4 * sizeof(u32));
+        return;
+    }
+
+    u32 counters[4] = {};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, stats.handle);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, slotOffset, sizeof(counters), counters);
+    app->occlusionDrawnFirstPhase = counters[0];
+    app->occlusionDrawnSecondPhase = counters[1];
+    app->occlusionCulled = counters[2];
+
+    const u32 zeros[4] = {};
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, slotOffset, sizeof(zeros), zeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void DispatchOcclusionCull(App* app, u32 phase)
+{
+    if (app->InstanceCount == 0)
+        return;
+
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 2, -1, phase == 0 ? "Occlusion Cull (previous frame)" : "Occlusion Cull (current frame)");
+
+    Program& program = app->programs[app->occlusionCullProgramIdx];
+    glUseProgram(program.handle);
+
+    const glm::mat4 viewProjection = phase == 0 ? app->hiZViewProjection : app->projection * app->view;
+    glUniformMatrix4fv(UniformLocation(program, UNIFORM("uViewProjection")), 1, GL_FALSE, glm::value_ptr(viewProjection));
+    glUniform1ui(UniformLocation(program, UNIFORM("uPhase")), phase);
+    glUniform1ui(UniformLocation(program, UNIFORM("uInstanceCount")), app->InstanceCount);
+    glUniform1i(UniformLocation(program, UNIFORM("uHiZValid")), app->hiZValid ? 1 : 0);
+    glUniform1i(UniformLocation(program, UNIFORM("uHiZLevels")), app->hiZLevels);
+    glUniform1i(UniformLocation(program, UNIFORM("uHiZ")), HIZ_TEXTURE_UNIT);
+
+    glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, app->hiZTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    const u32 commandsOffset = phase == 0 ? app->CommandsOffset : app->OcclusionCommandsOffset;
+    const u32 culledOffset = phase * MAX_INSTANCES * sizeof(InstanceData);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->instanceBuff.handle, app->InstanceParamsOffset, app->InstanceParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->objectBuff.handle);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(5), app->indirectBuff.handle, commandsOffset, app->CommandsSize);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(6), app->culledInstanceBuff.handle, culledOffset, app->InstanceParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), app->instanceVisibilityBuff.handle);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(8), app->occlusionStatsBuff.handle, app->indirectBuff.regionIdx * app->occlusionStatsStride, app->occlusionStatsStride);
+
+    glDispatchCompute((app->InstanceCount + 63) / 64, 1, 1);
+
+    // The draws read the instance counts as indirect commands and the instances as storage, the
+    // CPU reads the counters through the mapping once the frame fence signaled
+    GLbitfield barriers = GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT;
+    if (app->occlusionStatsBuff.persistent)
+        barriers |= GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT;
+    glMemoryBarrier(barriers);
+
+    glPopDebugGroup();
+}
@@ -0,0 +1,24 @@
+//
+// occlusion.h: Two phase Hi-Z occlusion culling. Instances are first tested against the
+// depth pyramid of the previous frame, the pyramid is rebuilt from the depth of what was
+// drawn and the rejected instances are tested again, so objects that became visible this
+// frame are still drawn and never pop in late.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// (Re)creates the pyramid for the current display size, the previous contents are discarded
+void CreateHiZPyramid(App* app);
+
+// Reduces depthAttachmentHandle into the pyramid, keeping the farthest depth of each texel
+void BuildHiZPyramid(App* app);
+
+// Reads back the counters of the oldest frame in flight and clears its slot
+void BeginOcclusionStats(App* app);
+
+// Tests the instances of this frame against the pyramid. Phase 0 uses the previous frame
+// pyramid and view projection, phase 1 the current ones and only the instances rejected
+// by phase 0. Visible instances are appended to the commands of their phase.
+void DispatchOcclusionCull(App* app, u32 phase);
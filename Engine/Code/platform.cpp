@@ -13,9 +13,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
 #endif
 
 #include "engine.h"
+#include "file_watcher.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
@@ -31,6 +36,9 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+// Hidden window only created for its context, shared with the main one
+GLFWwindow* GlobalWorkerWindow = NULL;
+
 bool CreateMenuBar() {
     bool ret = true;
     bool opt_fullscreen = true;
@@ -199,6 +207,10 @@ int main()
     glfwSetFramebufferSizeCallback(window, OnGlfwResizeFramebuffer);
     glfwSetWindowCloseCallback(window, OnGlfwCloseWindow);
 
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GlobalWorkerWindow = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, window);
+    glfwDefaultWindowHints();
+
     glfwMakeContextCurrent(window);
 
     // Load all OpenGL functions using the glfw loader function
@@ -312,11 +324,16 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+    ShutdownFileWatcher();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
+    if (GlobalWorkerWindow)
+        glfwDestroyWindow(GlobalWorkerWindow);
     glfwDestroyWindow(window);
 
     glfwTerminate();
@@ -399,6 +416,28 @@ String GetDirectoryPart(String path)
     return str;
 }
 
+String GetExecutableDirectory()
+{
+    char path[1024] = {};
+#ifdef _WIN32
+    const bool found = GetModuleFileNameA(NULL, path, sizeof(path)) < sizeof(path);
+#elif defined(__APPLE__)
+    u32 size = sizeof(path);
+    const bool found = _NSGetExecutablePath(path, &size) == 0;
+#else
+    const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    const bool found = length > 0;
+    path[found ? length : 0] = 0;
+#endif
+
+    if (!found || (!strchr(path, '/') && !strchr(path, '\\')))
+    {
+        ELOG("Could not find the executable path, using the working directory");
+        return MakeString(".");
+    }
+    return GetDirectoryPart(MakeString(path));
+}
+
 String ReadTextFile(const char* filepath)
 {
     String fileText = {};
@@ -439,16 +478,55 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
         return(conversor.u64time);
     }
 #else
-    // NOTE: This has not been tested in unix-like systems
+    // Nanoseconds, saves within the same second have to be told apart
     struct stat attrib;
     if (stat(filepath, &attrib) == 0) {
-        return attrib.st_mtime;
+#ifdef __APPLE__
+        return (u64)attrib.st_mtimespec.tv_sec * 1000000000ull + attrib.st_mtimespec.tv_nsec;
+#else
+        return (u64)attrib.st_mtim.tv_sec * 1000000000ull + attrib.st_mtim.tv_nsec;
+#endif
     }
 #endif
 
     return 0;
 }
 
+f64 GetFileTimestampAge(u64 timestamp)
+{
+#ifdef _WIN32
+    union Filetime2u64 {
+        FILETIME filetime;
+        u64      u64time;
+    } conversor;
+
+    GetSystemTimeAsFileTime(&conversor.filetime);
+    return (f64)(i64)(conversor.u64time - timestamp) * 1e-7; // 100 ns units
+#else
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (f64)(i64)((u64)now.tv_sec * 1000000000ull + now.tv_nsec - timestamp) * 1e-9;
+#endif
+}
+
+bool BindWorkerGLContext()
+{
+    if (!GlobalWorkerWindow)
+        return false;
+    glfwMakeContextCurrent(GlobalWorkerWindow);
+    return true;
+}
+
+void UnbindWorkerGLContext()
+{
+    glfwMakeContextCurrent(NULL);
+}
+
+void* GetGLProcAddress(const char* name)
+{
+    return (void*)glfwGetProcAddress(name);
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
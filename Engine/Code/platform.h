@@ -69,6 +69,12 @@ String MakePath(String dir, String filename);
 
 String GetDirectoryPart(String path);
 
+/**
+ * Directory of the running executable, without the trailing separator. Unlike relative paths it
+ * does not depend on the working directory the program was started from.
+ */
+String GetExecutableDirectory();
+
 /**
  * Reads a whole file and returns a string with its contents. The returned string
  * is temporary and should be copied if it needs to persist for several frames.
@@ -81,6 +87,29 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Seconds elapsed since a timestamp returned by GetFileLastWriteTimestamp.
+ */
+f64 GetFileTimestampAge(u64 timestamp);
+
+/**
+ * Makes current on the calling thread a hidden OpenGL context that shares its objects with
+ * the main window, so worker threads can create programs, buffers... Only one thread may use
+ * it at a time. Returns false if the context could not be created.
+ */
+bool BindWorkerGLContext();
+
+/**
+ * Releases the worker context from the calling thread, before the thread exits.
+ */
+void UnbindWorkerGLContext();
+
+/**
+ * It retrieves the address of an OpenGL function. Useful to load entry points that
+ * are not part of the core profile our glad loader was generated for (e.g. extensions).
+ */
+void* GetGLProcAddress(const char* name);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
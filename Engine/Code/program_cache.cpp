@@ -0,0 +1,258 @@
+#include "program_cache.h"
+#include <string>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define PROGRAM_CACHE_MAGIC   0x31435250 // "PRC1"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+    u32    magic;
+    u32    version;
+    u64    key;
+    GLenum binaryFormat;
+    u32    binarySize;
+};
+
+static u64 HashBytes(const void* data, size_t size, u64 hash = 14695981039346656037ull)
+{
+    const u8* bytes = (const u8*)data;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+static std::string CachePath(const App* app, u64 key)
+{
+    char name[32];
+    sprintf(name, "/%016llx.bin", (unsigned long long)key);
+    return app->programCacheDirectory + name;
+}
+
+// Name of a "#ifdef NAME" or "#if defined(NAME)" line, empty for any other line
+static std::string ConditionName(const char* line, const char* end)
+{
+    auto skipSpaces = [&](const char* c) { while (c < end && (*c == ' ' || *c == '\t' || *c == '\r')) ++c; return c; };
+    auto readName = [&](const char* c) { const char* n = c; while (c < end && (isalnum((u8)*c) || *c == '_')) ++c; return std::string(n, c); };
+
+    const char* c = skipSpaces(line);
+    if (strncmp(c, "#ifdef", 6) == 0)
+        return readName(skipSpaces(c + 6));
+    if (strncmp(c, "#if defined(", 12) == 0)
+    {
+        const char* close = c + 12;
+        std::string name = readName(close);
+        close += name.size();
+        // Only a lone defined() is resolved, conditions combining several are kept
+        return close < end && *close == ')' && skipSpaces(close + 1) == end ? name : std::string();
+    }
+    return std::string();
+}
+
+static bool IsDirective(const char* line, const char* end, const char* directive)
+{
+    while (line < end && (*line == ' ' || *line == '\t'))
+        ++line;
+    return strncmp(line, directive, strlen(directive)) == 0;
+}
+
+void InitProgramCache(App* app)
+{
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    app->programCacheEnabled = formatCount > 0;
+
+    if (!app->programCacheEnabled)
+    {
+        ILOG("Program binaries not supported by the driver, programs are compiled every time");
+        return;
+    }
+
+    // Resolved once here, the worker thread also loads and stores entries
+    app->programCacheDirectory = std::string(GetExecutableDirectory().str) + "/" PROGRAM_CACHE_DIRECTORY;
+#ifdef _WIN32
+    _mkdir(app->programCacheDirectory.c_str());
+#else
+    mkdir(app->programCacheDirectory.c_str(), 0755);
+#endif
+}
+
+ProgramSource PreprocessProgramSource(String source)
+{
+    ProgramSource result;
+    result.text = std::make_shared<const std::string>(source.str, source.len);
+
+    // Lines of the #if blocks still open, the innermost last
+    std::vector<u32> open;
+    const char* text = source.str;
+    const char* end = source.str + source.len;
+    for (const char* line = text; line < end;)
+    {
+        const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+        lineEnd = lineEnd ? lineEnd : end;
+
+        ProgramSourceLine sourceLine = {};
+        sourceLine.begin = (u32)(line - text);
+        sourceLine.end = (u32)(lineEnd - text);
+        sourceLine.blockEnd = UINT32_MAX;
+        const u32 index = (u32)result.lines.size();
+
+        if (IsDirective(line, lineEnd, "#if"))
+        {
+            sourceLine.condition = ConditionName(line, lineEnd);
+            open.push_back(index);
+        }
+        else if (IsDirective(line, lineEnd, "#el") || IsDirective(line, lineEnd, "#endif"))
+        {
+            // The first #else or #elif ends the skipped block, the branch it starts is kept
+            if (!open.empty() && result.lines[open.back()].blockEnd == UINT32_MAX)
+                result.lines[open.back()].blockEnd = index;
+            if (!open.empty() && IsDirective(line, lineEnd, "#endif"))
+                open.pop_back();
+        }
+        else if (IsDirective(line, lineEnd, "#define"))
+        {
+            const char* name = strstr(line, "#define") + 7;
+            while (name < lineEnd && (*name == ' ' || *name == '\t'))
+                ++name;
+            const char* nameEnd = name;
+            while (nameEnd < lineEnd && (isalnum((u8)*nameEnd) || *nameEnd == '_'))
+                ++nameEnd;
+            sourceLine.define = std::string(name, nameEnd);
+        }
+
+        result.lines.push_back(sourceLine);
+        line = lineEnd + 1;
+    }
+
+    // Unterminated blocks run to the end of the file
+    for (ProgramSourceLine& sourceLine : result.lines)
+        if (sourceLine.blockEnd == UINT32_MAX)
+            sourceLine.blockEnd = (u32)result.lines.size() - 1;
+
+    return result;
+}
+
+u64 ProgramCacheKey(const App* app, const ProgramSource& source, const char* programName, const char* defines, bool compute)
+{
+    // Names defined for this program. Blocks testing any other name are left out of the hash, the
+    // source compiled is still the whole file.
+    std::unordered_set<std::string> defined = { programName, compute ? "COMPUTE" : "VERTEX" };
+    if (!compute)
+        defined.insert("FRAGMENT");
+
+    u64 hash = HashBytes(defines, strlen(defines));
+    hash = HashBytes(programName, strlen(programName), hash);
+    hash = HashBytes(&compute, sizeof(compute), hash);
+
+    for (const char* d = strstr(defines, "#define "); d; d = strstr(d + 1, "#define "))
+    {
+        const char* name = d + 8;
+        const char* nameEnd = name;
+        while (*nameEnd && (isalnum((u8)*nameEnd) || *nameEnd == '_'))
+            ++nameEnd;
+        defined.insert(std::string(name, nameEnd));
+    }
+
+    const char* text = source.text->data();
+    for (u32 i = 0; i < source.lines.size(); ++i)
+    {
+        const ProgramSourceLine* line = &source.lines[i];
+        if (!line->condition.empty() && !defined.count(line->condition))
+        {
+            // Skip to the matching #endif, or to an #else or #elif branch, which is kept
+            i = line->blockEnd;
+            line = &source.lines[i];
+        }
+        else if (!line->define.empty())
+        {
+            // Names the file defines for itself count as defined from here on
+            defined.insert(line->define);
+        }
+
+        hash = HashBytes(text + line->begin, line->end - line->begin, hash);
+    }
+
+    // Binaries are only valid for the driver that built them
+    hash = HashBytes(app->info.GLVendor.c_str(), app->info.GLVendor.size(), hash);
+    hash = HashBytes(app->info.GLRender.c_str(), app->info.GLRender.size(), hash);
+    hash = HashBytes(app->info.GLVers.c_str(), app->info.GLVers.size(), hash);
+    return hash;
+}
+
+GLuint LoadCachedProgram(App* app, u64 key)
+{
+    if (!app->programCacheEnabled)
+        return 0;
+
+    FILE* file = fopen(CachePath(app, key).c_str(), "rb");
+    if (!file)
+        return 0;
+
+    ProgramCacheHeader header = {};
+    std::vector<u8> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION && header.key == key;
+    if (valid)
+    {
+        binary.resize(header.binarySize);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+
+    if (!valid)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, binary.data(), header.binarySize);
+
+    // Drivers may still reject binaries of an older build of themselves
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void StoreCachedProgram(App* app, u64 key, GLuint program)
+{
+    if (!app->programCacheEnabled)
+        return;
+
+    GLint linked = GL_FALSE, binarySize = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (!linked || binarySize <= 0)
+        return;
+
+    ProgramCacheHeader header = {};
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+
+    std::vector<u8> binary(binarySize);
+    GLsizei length = 0;
+    glGetProgramBinary(program, binarySize, &length, &header.binaryFormat, binary.data());
+    header.binarySize = length;
+
+    FILE* file = fopen(CachePath(app, key).c_str(), "wb");
+    if (!file)
+    {
+        ELOG("Could not write program binary %s", CachePath(app, key).c_str());
+        return;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary.data(), 1, length, file);
+    fclose(file);
+}
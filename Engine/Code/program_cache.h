@@ -0,0 +1,49 @@
+//
+// program_cache.h: On-disk program binary cache. Linked programs are saved with glGetProgramBinary
+// and loaded back with glProgramBinary, skipping the compile. Entries are keyed by a hash of the
+// text the compiler sees for the program (blocks of the file its defines turn off are left out,
+// so editing another program does not invalidate it), its defines and the driver. The files live
+// in PROGRAM_CACHE_DIRECTORY next to the executable, so starting it from another working directory
+// neither misses the cache nor scatters copies of it.
+//
+
+#pragma once
+
+#include "engine.h"
+#include <memory>
+
+#define PROGRAM_CACHE_DIRECTORY "ShaderCache"
+
+// Line of a program file with the directives the cache key depends on already parsed
+struct ProgramSourceLine
+{
+    u32         begin, end;  // bytes of the line in the text, without the newline
+    u32         blockEnd;    // #endif, #else or #elif line ending the block of an #if line
+    std::string condition;   // NAME of an "#ifdef NAME" or "#if defined(NAME)" line
+    std::string define;      // NAME of a "#define NAME" line
+};
+
+// Program file read and parsed once, shared by the keys and builds of all the programs made from it
+struct ProgramSource
+{
+    std::shared_ptr<const std::string> text;
+    std::vector<ProgramSourceLine>     lines;
+};
+
+ProgramSource PreprocessProgramSource(String source);
+
+// The whole text, as the compiler gets it
+inline String ProgramSourceText(const ProgramSource& source)
+{
+    return { (char*)source.text->data(), (u32)source.text->size() };
+}
+
+// Enables the cache if the driver supports at least one binary format
+void InitProgramCache(App* app);
+
+u64 ProgramCacheKey(const App* app, const ProgramSource& source, const char* programName, const char* defines, bool compute);
+
+// Linked program of the entry, 0 on a miss or if the driver rejects the binary
+GLuint LoadCachedProgram(App* app, u64 key);
+
+void StoreCachedProgram(App* app, u64 key, GLuint program);
@@ -0,0 +1,260 @@
+#include "program_reload.h"
+#include "gl_extensions.h"
+#include "program_cache.h"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct ProgramBuildJob
+{
+    u32         id;
+    std::shared_ptr<const std::string> source; // shared by the jobs of one save
+    std::string programName;
+    std::string defines;
+    bool        compute;
+};
+
+struct ProgramBuildResult
+{
+    u32    id;
+    GLuint handle;
+    bool   linked;
+};
+
+// Shared with the worker thread, which only sees jobs and results
+struct ProgramBuildWorker
+{
+    std::thread                    thread;
+    std::mutex                     mutex;
+    std::condition_variable        wake;
+    std::deque<ProgramBuildJob>    jobs;
+    std::vector<ProgramBuildResult> results;
+    bool                           running;
+    bool                           stop;
+};
+
+static ProgramBuildWorker Worker;
+static u32 NextBuildId = 1;
+
+static void WorkerMain(std::promise<bool>* started)
+{
+    const bool bound = BindWorkerGLContext();
+    started->set_value(bound);
+    if (!bound)
+        return;
+
+    for (;;)
+    {
+        ProgramBuildJob job;
+        {
+            std::unique_lock<std::mutex> lock(Worker.mutex);
+            Worker.wake.wait(lock, []() { return Worker.stop || !Worker.jobs.empty(); });
+            if (Worker.stop)
+                break;
+            job = std::move(Worker.jobs.front());
+            Worker.jobs.pop_front();
+        }
+
+        String source = { (char*)job.source->data(), (u32)job.source->size() };
+        GLuint shaders[2];
+        const GLuint handle = SubmitProgramFromSource(source, job.programName.c_str(), job.defines.c_str(), job.compute, shaders);
+        const bool linked = FinishProgramFromSource(handle, shaders, job.programName.c_str());
+
+        // The main context may only use the program once the commands that built it completed
+        glFinish();
+
+        std::lock_guard<std::mutex> lock(Worker.mutex);
+        Worker.results.push_back({ job.id, handle, linked });
+    }
+
+    UnbindWorkerGLContext();
+}
+
+void InitProgramReload()
+{
+    if (GLExt.parallelShaderCompile)
+    {
+        // Let the driver pick how many threads it compiles on
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        ILOG("Program reload: parallel shader compile");
+        return;
+    }
+
+    std::promise<bool> started;
+    Worker.stop = false;
+    Worker.thread = std::thread(WorkerMain, &started);
+    Worker.running = started.get_future().get();
+    if (!Worker.running)
+        Worker.thread.join();
+
+    ILOG("Program reload: %s", Worker.running ? "worker thread with a shared context" : "synchronous, no shared context");
+}
+
+void ShutdownProgramReload(App* app)
+{
+    if (Worker.running)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Worker.mutex);
+            Worker.stop = true;
+        }
+        Worker.wake.notify_one();
+        Worker.thread.join();
+        Worker.running = false;
+
+        for (const ProgramBuildResult& result : Worker.results)
+            glDeleteProgram(result.handle);
+        Worker.results.clear();
+        Worker.jobs.clear();
+    }
+
+    for (ProgramBuild& build : app->programBuilds)
+    {
+        if (build.shaders[0] != 0)
+            FinishProgramFromSource(build.handle, build.shaders, app->programs[build.programIdx].programName.c_str());
+        glDeleteProgram(build.handle);
+    }
+    app->programBuilds.clear();
+}
+
+void RequestProgramBuild(App* app, u32 programIdx, u64 sourceTimestamp, const ProgramSource& programSource)
+{
+    Program& program = app->programs[programIdx];
+    String source = ProgramSourceText(programSource);
+
+    ProgramBuild build = {};
+    build.id = NextBuildId++;
+    build.programIdx = programIdx;
+    build.generation = ++program.buildGeneration;
+    build.sourceTimestamp = sourceTimestamp;
+    build.cacheKey = ProgramCacheKey(app, programSource, program.programName.c_str(), program.defines.c_str(), program.compute);
+
+    // Unchanged programs of the file come back from the cache right away
+    build.handle = LoadCachedProgram(app, build.cacheKey);
+    if (build.handle != 0)
+    {
+        app->programCacheHits++;
+        build.cached = build.done = build.linked = true;
+    }
+    else if (GLExt.parallelShaderCompile)
+    {
+        app->programCacheMisses++;
+        build.handle = SubmitProgramFromSource(source, program.programName.c_str(), program.defines.c_str(), program.compute, build.shaders);
+    }
+    else if (Worker.running)
+    {
+        app->programCacheMisses++;
+        ProgramBuildJob job = { build.id, programSource.text, program.programName, program.defines, program.compute };
+        {
+            std::lock_guard<std::mutex> lock(Worker.mutex);
+            Worker.jobs.push_back(std::move(job));
+        }
+        Worker.wake.notify_one();
+    }
+    else
+    {
+        app->programCacheMisses++;
+        build.handle = SubmitProgramFromSource(source, program.programName.c_str(), program.defines.c_str(), program.compute, build.shaders);
+        build.linked = FinishProgramFromSource(build.handle, build.shaders, program.programName.c_str());
+        build.done = true;
+    }
+
+    app->programBuilds.push_back(build);
+}
+
+void ApplyProgramBuilds(App* app)
+{
+    if (app->programBuilds.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(Worker.mutex);
+        for (const ProgramBuildResult& result : Worker.results)
+        {
+            for (ProgramBuild& build : app->programBuilds)
+            {
+                if (build.id != result.id)
+                    continue;
+                build.handle = result.handle;
+                build.linked = result.linked;
+                build.done = true;
+            }
+        }
+        Worker.results.clear();
+    }
+
+    // Builds the driver compiles in parallel are done once the link completed, asking earlier would block
+    for (ProgramBuild& build : app->programBuilds)
+    {
+        if (build.done || build.shaders[0] == 0)
+            continue;
+
+        GLint completed = GL_FALSE;
+        glGetProgramiv(build.handle, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed)
+        {
+            build.linked = FinishProgramFromSource(build.handle, build.shaders, app->programs[build.programIdx].programName.c_str());
+            build.done = true;
+        }
+    }
+
+    // The programs of a save are swapped together, so passes never mix old and new versions
+    for (u32 i = 0; i < app->programBuilds.size();)
+    {
+        const u64 timestamp = app->programBuilds[i].sourceTimestamp;
+        bool saveDone = true;
+        for (const ProgramBuild& build : app->programBuilds)
+            saveDone &= build.sourceTimestamp != timestamp || build.done;
+
+        if (!saveDone)
+        {
+            ++i;
+            continue;
+        }
+
+        u32 swapped = 0, failed = 0;
+        for (u32 j = i; j < app->programBuilds.size();)
+        {
+            ProgramBuild& build = app->programBuilds[j];
+            if (build.sourceTimestamp != timestamp)
+            {
+                ++j;
+                continue;
+            }
+
+            Program& program = app->programs[build.programIdx];
+            if (build.generation != program.buildGeneration)
+            {
+                // A later save rebuilds it again
+                glDeleteProgram(build.handle);
+            }
+            else if (!build.linked)
+            {
+                ELOG("Program %s failed to build, keeping the previous version", program.programName.c_str());
+                glDeleteProgram(build.handle);
+                failed++;
+            }
+            else
+            {
+                if (!build.cached)
+                    StoreCachedProgram(app, build.cacheKey, build.handle);
+
+                glDeleteProgram(program.handle);
+                program.handle = build.handle;
+                ReflectProgram(program);
+                swapped++;
+            }
+
+            app->programBuilds.erase(app->programBuilds.begin() + j);
+        }
+
+        if (swapped > 0)
+        {
+            app->programReloadLatency = GetFileTimestampAge(timestamp);
+            ILOG("Reloaded %u programs (%u failed) %.0f ms after the save", swapped, failed, app->programReloadLatency * 1000.0);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+//
+// program_reload.h: Hot reload without hitches. Programs whose source changed are rebuilt in the
+// background, with GL_KHR_parallel_shader_compile when the driver has it and on a worker thread
+// with a shared context otherwise. The program in use keeps drawing until its replacement linked;
+// the replacements of one save are swapped in together at the start of a frame, and the ones that
+// fail to build are dropped with the previous version kept.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "program_cache.h"
+
+// Starts the worker thread when the driver cannot compile in parallel itself
+void InitProgramReload();
+
+// Drops the pending builds and stops the worker thread
+void ShutdownProgramReload(App* app);
+
+// Starts rebuilding a program from source, its file as written at sourceTimestamp. The programs of
+// one file share the source read for them. Replaces any build of it still pending.
+void RequestProgramBuild(App* app, u32 programIdx, u64 sourceTimestamp, const ProgramSource& source);
+
+// Swaps in the programs whose rebuild finished, to be called at the start of the frame
+void ApplyProgramBuilds(App* app);
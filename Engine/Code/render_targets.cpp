@@ -0,0 +1,111 @@
+#include "render_targets.h"
+
+#define RENDER_TARGET_MAX_UNUSED_FRAMES 120
+
+static u32 FormatBytes(GLenum format)
+{
+    switch (format)
+    {
+    case GL_R8:                 return 1;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_R16UI:              return 2;
+    case GL_RGBA8:
+    case GL_RG16:
+    case GL_R32F:
+    case GL_DEPTH_COMPONENT24:  return 4; // padded to 32 bits
+    case GL_RGBA16F:
+    case GL_RG32F:              return 8;
+    case GL_RGBA32F:            return 16;
+    default:
+        ASSERT(false, "Unknown render target format, add its size");
+        return 4;
+    }
+}
+
+u32 RenderTargetBytes(ivec2 size, GLenum format, u32 levels)
+{
+    u32 bytes = 0;
+    for (u32 level = 0; level < levels; ++level)
+        bytes += glm::max(size.x >> level, 1) * glm::max(size.y >> level, 1) * FormatBytes(format);
+    return bytes;
+}
+
+GLuint AcquireRenderTarget(RenderTargetPool& pool, ivec2 size, GLenum format, u32 levels)
+{
+    size = glm::max(size, ivec2(1));
+
+    for (RenderTarget& target : pool.targets)
+    {
+        if (target.busy || target.size != size || target.format != format || target.levels != levels)
+            continue;
+
+        if (target.lastUsedFrame == pool.frame)
+            pool.reusedCount++;
+        target.generation = pool.generation;
+        target.busy = true;
+        target.lastUsedFrame = pool.frame;
+        return target.handle;
+    }
+
+    RenderTarget target = {};
+    target.size = size;
+    target.format = format;
+    target.levels = levels;
+    target.generation = pool.generation;
+    target.lastUsedFrame = pool.frame;
+    target.busy = true;
+
+    glGenTextures(1, &target.handle);
+    glBindTexture(GL_TEXTURE_2D, target.handle);
+    glTexStorage2D(GL_TEXTURE_2D, levels, format, size.x, size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pool.targets.push_back(target);
+    pool.bytes += RenderTargetBytes(size, format, levels);
+    return target.handle;
+}
+
+void ReleaseRenderTarget(RenderTargetPool& pool, GLuint& handle)
+{
+    for (RenderTarget& target : pool.targets)
+        if (target.handle == handle)
+            target.busy = false;
+    handle = 0;
+}
+
+void BeginRenderTargetGeneration(RenderTargetPool& pool)
+{
+    pool.generation++;
+}
+
+void BeginRenderTargetFrame(RenderTargetPool& pool)
+{
+    pool.frame++;
+    pool.reusedCount = 0;
+}
+
+bool TrimRenderTargets(RenderTargetPool& pool)
+{
+    bool deleted = false;
+    for (u32 i = 0; i < pool.targets.size();)
+    {
+        const RenderTarget& target = pool.targets[i];
+        const bool stale = target.generation != pool.generation || pool.frame - target.lastUsedFrame > RENDER_TARGET_MAX_UNUSED_FRAMES;
+        if (target.busy || !stale)
+        {
+            ++i;
+            continue;
+        }
+
+        pool.bytes -= RenderTargetBytes(target.size, target.format, target.levels);
+        glDeleteTextures(1, &target.handle);
+        pool.targets.erase(pool.targets.begin() + i);
+        deleted = true;
+    }
+    return deleted;
+}
@@ -0,0 +1,28 @@
+//
+// render_targets.h: Pool of render target textures with immutable storage, keyed by size,
+// format and mip count. Targets given back to the pool are handed out again to the next
+// request with the same key, and deleted once they are left over from a resize or unused
+// for a while.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Idle target with the same key if there is one, a new one otherwise. The texture has nearest
+// filtering and clamps to edge, holders needing other parameters set them after acquiring it.
+GLuint AcquireRenderTarget(RenderTargetPool& pool, ivec2 size, GLenum format, u32 levels = 1);
+
+// Gives the target back to the pool and sets handle to 0
+void ReleaseRenderTarget(RenderTargetPool& pool, GLuint& handle);
+
+// Idle targets of the current generation are kept for reuse, the older ones are deleted
+void BeginRenderTargetGeneration(RenderTargetPool& pool);
+
+void BeginRenderTargetFrame(RenderTargetPool& pool);
+
+// Deletes the idle targets of an older generation or unused for a while. Returns whether any was
+// deleted, framebuffers built over them must be released.
+bool TrimRenderTargets(RenderTargetPool& pool);
+
+u32 RenderTargetBytes(ivec2 size, GLenum format, u32 levels = 1);
@@ -0,0 +1,16 @@
+//
+// simd.h: Widest float vector the build targets, for the batch loops that process SIMD_WIDTH
+// elements at a time. AVX gives 8 lanes, SSE 4 and anything else falls back to scalar code.
+//
+
+#pragma once
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
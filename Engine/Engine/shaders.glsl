@@ -1,3 +1,119 @@
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
+
+//-------------------------------------------------------------------------
+// Octahedral normals of the G buffer, shared by the passes that write and read it
+#if defined(FRAGMENT) && (defined(Mode_ForwardShading) || defined(Mode_DeferredGeometry))
+
+vec2 OctWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Unit normal folded onto the octahedron and unrolled into [0, 1]^2
+vec2 EncodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+	return n.xy * 0.5 + 0.5;
+}
+
+#elif !defined(VERTEX) && (defined(Mode_DeferredLighting) || defined(Mode_DeferredLightingTiled) || defined(Mode_GBufferDebug))
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 f = encoded * 2.0 - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+#endif
+
+//-------------------------------------------------------------------------
+// Relief mapping, shared by the material passes. The height map is a parameter since the bindless
+// variants fetch it from the material of the fragment.
+#if defined(FRAGMENT) && defined(RELIEF_MAP) && (defined(Mode_ForwardShading) || defined(Mode_DeferredGeometry))
+
+uniform int texSize;
+uniform int steps;
+uniform int coneSteps;
+uniform float uReliefLodDistance;
+
+uniform float uHeightBump;
+
+// The linear search used to move uHeightBump / texSize per step, the relief depth keeps the look
+// it had with the default 200 steps whatever the step count
+const float RELIEF_REFERENCE_STEPS = 200.0;
+
+// Head-on and far away the parallax is small and fewer steps do
+int reliefStepCount(int maxSteps, vec3 rayTexspace, vec3 viewDir)
+{
+	float grazing = 1.0 - abs(rayTexspace.z);
+	float distanceScale = clamp(uReliefLodDistance / length(viewDir), 0.25, 1.0);
+	return max(int(ceil(float(maxSteps) * mix(0.25, 1.0, grazing) * distanceScale)), 1);
+}
+
+#ifdef CONE_STEP_MAPPING
+// Cone step mapping: the g channel of the height map holds the square root of the widest empty
+// cone above each texel, so every step moves the ray to the edge of that cone
+vec2 coneStepMapping(sampler2D heightTex, vec2 texCoords, vec3 rayTexspace, vec3 viewDir, float reliefDepth)
+{
+	// Ray movement per unit of depth, and its length in texture space
+	vec3 rayStep = vec3(reliefDepth * rayTexspace.xy / abs(rayTexspace.z), 1.0);
+	float rayWidth = length(rayStep.xy);
+
+	vec3 samplePositionTexspace = vec3(texCoords, 0.0);
+	int stepCount = reliefStepCount(coneSteps, rayTexspace, viewDir);
+	for (int i = 0; i < stepCount; ++i)
+	{
+		vec2 depthCone = textureLod(heightTex, samplePositionTexspace.xy, 0.0).rg;
+		float coneRatio = depthCone.g * depthCone.g;
+		float height = depthCone.r - samplePositionTexspace.z;
+		if (height <= 0.0)
+			break;
+
+		samplePositionTexspace += rayStep * (coneRatio * height / (coneRatio + rayWidth));
+	}
+	return samplePositionTexspace.xy;
+}
+#endif
+
+// Parallax occlusion mapping aka. relief mapping, viewDir goes from the fragment to the camera
+vec2 reliefMapping(sampler2D heightTex, vec2 texCoords, mat3 tangentSpaceMat, vec3 viewDir)
+{
+
+	 // Compute the view ray in texture space
+	 vec3 rayTexspace = transpose(tangentSpaceMat) * normalize(-viewDir);
+	 float reliefDepth = uHeightBump * RELIEF_REFERENCE_STEPS / float(texSize);
+
+#ifdef CONE_STEP_MAPPING
+	 return coneStepMapping(heightTex, texCoords, rayTexspace, viewDir, reliefDepth);
+#else
+	 // Increment
+	 int stepCount = reliefStepCount(steps, rayTexspace, viewDir);
+	 vec3 rayIncrementTexspace;
+	 rayIncrementTexspace.xy = reliefDepth * rayTexspace.xy / abs(rayTexspace.z * stepCount);
+	 rayIncrementTexspace.z = 1.0/stepCount;
+	 
+	 // Sampling state
+	 vec3 samplePositionTexspace = vec3(texCoords, 0.0);
+	 float sampledDepth = /*1.0 -*/ texture(heightTex, samplePositionTexspace.xy).r;
+	 
+	 // Linear search
+	 for (int i = 0; i < stepCount && samplePositionTexspace.z < sampledDepth; ++i)
+	 {
+		 samplePositionTexspace += rayIncrementTexspace;
+		 sampledDepth = /*1.0 -*/ texture(heightTex, samplePositionTexspace.xy).r;
+	 }
+	 return samplePositionTexspace.xy;
+#endif
+}
+
+#endif
+
 //-------------------------------------------------------------------------
 #ifdef TEXTURED_GEOMETRY
 
@@ -40,13 +156,10 @@ void main()
 
 #ifdef Mode_ForwardShading
 
-struct Light
-{
-    unsigned int    type;
-    vec3            color;
-    vec3            direction;
-    vec3            position;
-};
+// Tangent frame of the normal and relief mapping variants
+#if defined(NORMAL_MAP) || defined(RELIEF_MAP)
+#define TANGENT_SPACE
+#endif
 
 #if defined(VERTEX)
 
@@ -55,114 +168,169 @@ layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 layout(location = 3) in vec3 aTangent;
 layout(location = 4) in vec3 aBitangent;
+layout(location = 5) in uint aInstanceIdx; // gl_InstanceID + base instance of the draw
 
 layout(binding = 0, std140) uniform GlobalParams
 {
     vec3            uCameraPosition;
     unsigned int    uLightCount;
-    Light           uLight[16];
+    unsigned int    uLightCapacity;
 };
 
 layout(binding = 1, std140) uniform LocalParams
 {
-    mat4        model;
     mat4        view;
     mat4        projection;
 };
 
+struct ObjectData
+{
+    mat4        model;
+    mat4        normalMatrix;
+    vec4        aabbMin;    // World space, used by the occlusion culling
+    vec4        aabbMax;
+};
+
+// x: object index, y: material index, z: batch index
+layout(binding = 2, std430) readonly buffer InstanceParams
+{
+    uvec4       uInstance[];
+};
+
+// Persistent, only the entities that changed are re-uploaded
+layout(binding = 4, std430) readonly buffer ObjectParams
+{
+    ObjectData  uObjects[];
+};
+
 out vec2 vTexCoord;
 out vec3 vPosition; // In World space
 out vec3 vNormal;   // In World space
 out vec3 vViewDir;  // In World space
-out vec3 vTangent;	
+#ifdef TANGENT_SPACE
+out vec3 vTangent;
 out vec3 vBitangent;
+#endif
+flat out uint vMaterialIdx;
+#ifdef CLUSTERED_LIGHTING
+out float vViewDepth; // selects the depth slice of the cluster
+#endif
+
+// The depth prepass computes the same position, so the shading pass can test for equality
+invariant gl_Position;
 
 void main()
 {
+    uvec4 instance = uInstance[aInstanceIdx];
+    mat4 model = uObjects[instance.x].model;
+    mat4 normalMatrix = uObjects[instance.x].normalMatrix;
+    vMaterialIdx = instance.y;
+
     vTexCoord = aTexCoord;
     vPosition = vec3(model* vec4(aPosition, 1.0));
-    vNormal = vec3(model * vec4(aNormal, 0.0));
+    vNormal = vec3(normalMatrix * vec4(aNormal, 0.0));
     vViewDir = vec3(uCameraPosition - vPosition);
+#ifdef TANGENT_SPACE
 	vTangent = normalize(vec3(model * vec4(aTangent, 0.0)));
     vBitangent = normalize(vec3(model * vec4(aBitangent, 0.0)));
+#endif
     gl_Position = projection * view * model * vec4(aPosition, 1.0);
+#ifdef CLUSTERED_LIGHTING
+    vViewDepth = -(view * model * vec4(aPosition, 1.0)).z;
+#endif
 }
 
 #elif defined(FRAGMENT) //------------------------------------------
 
-struct Light
-{
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
-
 in vec2 vTexCoord;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal; // in worldspace
 in vec3 vViewDir; // in worldspace
+#ifdef TANGENT_SPACE
 in vec3 vTangent;
 in vec3 vBitangent;
+#endif
+flat in uint vMaterialIdx;
+#ifdef CLUSTERED_LIGHTING
+in float vViewDepth;
 
-uniform sampler2D uTexture;
-uniform sampler2D uNormalTex;
-uniform sampler2D uHeightTex;
+// x: offset in uClusterLights, y: light count
+layout(binding = 5, std430) readonly buffer ClusterGrid
+{
+	uvec2       uClusters[];
+};
 
-uniform int normalMapBool;
-uniform int heightMapBool;
+layout(binding = 6, std430) readonly buffer ClusterLights
+{
+	uint        uClusterLights[];
+};
 
-uniform int texSize;
-uniform int steps;
+uniform uvec3 uClusterCount;
+uniform vec2 uClusterTileSize;
+uniform float uClusterScale;
+uniform float uClusterBias;
 
-uniform float uHeightBump;
+uint ClusterIndex()
+{
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / uClusterTileSize), uClusterCount.xy - 1u);
+	uint slice = min(uint(max(log(vViewDepth) * uClusterScale + uClusterBias, 0.0)), uClusterCount.z - 1u);
+	return (slice * uClusterCount.y + tile.y) * uClusterCount.x + tile.x;
+}
+#endif
 
-layout(binding = 0, std140) uniform GlobalParams
+struct MaterialData
 {
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
+    vec4        albedo;   // a: smoothness
+    vec4        emissive;
+    uvec2       albedoTexture;
+    uvec2       normalTexture;
+    uvec2       heightTexture;
+    uvec2       unused;
 };
 
-layout(location = 0) out vec4 oColor;
-layout(location = 1) out vec4 oNormals;
-layout(location = 2) out vec4 oAlbedo;
-layout(location = 3) out vec4 oDepth;
-layout(location = 4) out vec4 oPosition;
+// The material is the same for every instance of a draw command, so the handles are dynamically uniform
+layout(binding = 3, std430) readonly buffer MaterialParams
+{
+    MaterialData uMaterials[];
+};
 
-float near = 0.1; 
-float far  = 100.0;
+#ifdef BINDLESS_TEXTURES
+#define uTexture   sampler2D(uMaterials[vMaterialIdx].albedoTexture)
+#define uNormalTex sampler2D(uMaterials[vMaterialIdx].normalTexture)
+#define uHeightTex sampler2D(uMaterials[vMaterialIdx].heightTexture)
+#else
+uniform sampler2D uTexture;
+#ifdef NORMAL_MAP
+uniform sampler2D uNormalTex;
+#endif
+#ifdef RELIEF_MAP
+uniform sampler2D uHeightTex;
+#endif
+#endif
 
-float DepthCalc(float depth) 
+layout(binding = 0, std140) uniform GlobalParams
 {
-    float z = depth * 2.0 - 1.0; // back to NDC 
-    return (2.0 * near * far) / (far + near - z * (far - near));	
-}
+	vec3 uCameraPosition;
+	unsigned int uLightCount;
+	unsigned int uLightCapacity;
+};
 
-// Parallax occlusion mapping aka. relief mapping
-vec2 reliefMapping(vec2 texCoords, mat3 tangentSpaceMat)
+// Lights as three SoA streams of uLightCapacity entries
+layout(binding = 1, std430) readonly buffer LightParams
 {
+	vec4 uLights[];
+};
 
-	 // Compute the view ray in texture space
-	 vec3 rayTexspace = transpose(tangentSpaceMat) * normalize(-vViewDir.xyz);
-	 
-	 // Increment
-	 vec3 rayIncrementTexspace;
-	 rayIncrementTexspace.xy = uHeightBump * rayTexspace.xy / abs(rayTexspace.z * texSize);
-	 rayIncrementTexspace.z = 1.0/steps;
-	 
-	 // Sampling state
-	 vec3 samplePositionTexspace = vec3(texCoords, 0.0);
-	 float sampledDepth = /*1.0 -*/ texture(uHeightTex, samplePositionTexspace.xy).r;
-	 
-	 // Linear search
-	 for (int i = 0; i < steps && samplePositionTexspace.z < sampledDepth; ++i)
-	 {
-		 samplePositionTexspace += rayIncrementTexspace;
-		 sampledDepth = /*1.0 -*/ texture(uHeightTex, samplePositionTexspace.xy).r;
-	 }
-	 return samplePositionTexspace.xy;
-}
+vec4 LightPositionRadius(uint i) { return uLights[i]; }                      // xyz: position, w: radius
+vec4 LightColorType(uint i)      { return uLights[uLightCapacity + i]; }      // rgb: color, w: type
+vec4 LightDirection(uint i)      { return uLights[2u * uLightCapacity + i]; }
+
+// The relief only offsets texture coordinates, fragments keep the depth the prepass tested
+layout(depth_unchanged) out float gl_FragDepth;
+
+layout(location = 0) out vec4 oColor;
+layout(location = 1) out vec2 oNormals;	// octahedral, the position is reconstructed from depth
+layout(location = 2) out vec4 oAlbedo;
 
 void main()
 {
@@ -171,25 +339,27 @@ void main()
     float shininess = 1.0;		// how strong specular reflections are (more shininess harder and smaller spec)
 	//vec4 albedo = texture(uTexture, vTexCoord);
 
+    vec3 N = normalize(vNormal);
+#ifdef TANGENT_SPACE
 	vec3 T = normalize(vTangent);
 	vec3 B = normalize(vBitangent);
-    vec3 N = normalize(vNormal);
-	mat3 TBN = mat3(T, B, N);	
-	
+	mat3 TBN = mat3(T, B, N);
+#endif
+
 	vec2 tcoords = vTexCoord;
 
-	if(heightMapBool ==1.0)
-		tcoords = reliefMapping(tcoords, TBN);
+#ifdef RELIEF_MAP
+	tcoords = reliefMapping(uHeightTex, tcoords, TBN, vViewDir);
+#endif
 
-	vec3 albedo = texture(uTexture, tcoords).rgb;
+	vec3 albedo = texture(uTexture, tcoords).rgb * uMaterials[vMaterialIdx].albedo.rgb;
 
-	if (normalMapBool == 1.0)
-	{
-		vec3 tangentSpaceNormal = texture(uNormalTex, tcoords).xyz * 2.0 - vec3(1.0);
-		N = TBN * tangentSpaceNormal;
-	}
+#ifdef NORMAL_MAP
+	vec3 tangentSpaceNormal = texture(uNormalTex, tcoords).xyz * 2.0 - vec3(1.0);
+	N = TBN * tangentSpaceNormal;
+#endif
 	
-	oNormals = vec4(N, 1.0);
+	oNormals = EncodeNormal(normalize(N));
 
 	// Ambient
     float ambientIntensity = 0.5;
@@ -201,35 +371,41 @@ void main()
 	vec3 diffuseColor;
 	vec3 specularColor;
 
+#ifdef CLUSTERED_LIGHTING
+	uvec2 cluster = uClusters[ClusterIndex()];
+	for(uint c = 0u; c < cluster.y; ++c)
+	{
+		uint i = uClusterLights[cluster.x + c];
+#else
 	for(int i = 0; i < uLightCount; ++i)
 	{
+#endif
 	    float attenuation = 0.3f;
 		
 		// If it is a point light, attenuate according to distance
-		if(uLight[i].type == 1)
-			attenuation = 2.0 / length(uLight[i].position - vPosition);
+		if(LightColorType(i).w == 1.0)
+		{
+			// Windowed so the light reaches exactly zero at its radius
+			float distance = length(LightPositionRadius(i).xyz - vPosition);
+			float window = clamp(1.0 - pow(distance / LightPositionRadius(i).w, 4.0), 0.0, 1.0);
+			attenuation = 2.0 / distance * window * window;
+		}
 	        
-	    vec3 L = normalize(uLight[i].direction - vViewDir.xyz); // Light direction 
+	    vec3 L = normalize(LightDirection(i).xyz - vViewDir.xyz); // Light direction 
 	    vec3 R = reflect(-L, N);								// reflected vector
 	    
 	    // Diffuse
 	    float diffuseIntensity = max(0.0, dot(N, L));
-	    diffuseColor += attenuation * albedo.xyz * uLight[i].color * diffuseIntensity;
+	    diffuseColor += attenuation * albedo.xyz * LightColorType(i).rgb * diffuseIntensity;
 	    
 	    // Specular
 	    float specularIntensity = pow(max(dot(R, V), 0.0), shininess);
-	    specularColor += attenuation * specular * uLight[i].color * specularIntensity;
+	    specularColor += attenuation * specular * LightColorType(i).rgb * specularIntensity;
 	}
 
-	oColor = vec4(ambientColor + diffuseColor + specularColor, 1.0);
-
-	//oNormals = vec4(normalize(vNormal), 1.0); 
-	oAlbedo = texture(uTexture, tcoords);
-
-	float depth = DepthCalc(gl_FragCoord.z) / far; // divide by far for demonstration
-	oDepth = vec4(vec3(depth), 1.0);
+	oColor = vec4(ambientColor + diffuseColor + specularColor + uMaterials[vMaterialIdx].emissive.rgb, 1.0);
 
-	oPosition = vec4(vPosition, 1.0);
+	oAlbedo = vec4(albedo, 1.0);
 }
 
 #endif
@@ -267,13 +443,10 @@ void main()
 
 #ifdef Mode_DeferredGeometry
 
-struct Light
-{
-    unsigned int    type;
-    vec3            color;
-    vec3            direction;
-    vec3            position;
-};
+// Tangent frame of the normal and relief mapping variants
+#if defined(NORMAL_MAP) || defined(RELIEF_MAP)
+#define TANGENT_SPACE
+#endif
 
 #if defined(VERTEX)
 
@@ -282,142 +455,153 @@ layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 layout(location = 3) in vec3 aTangent;
 layout(location = 4) in vec3 aBitangent;
+layout(location = 5) in uint aInstanceIdx; // gl_InstanceID + base instance of the draw
 
 layout(binding = 0, std140) uniform GlobalParams
 {
     vec3            uCameraPosition;
     unsigned int    uLightCount;
-    Light           uLight[16];
+    unsigned int    uLightCapacity;
 };
 
 layout(binding = 1, std140) uniform LocalParams
 {
-    mat4        model;
     mat4        view;
     mat4        projection;
 };
 
+struct ObjectData
+{
+    mat4        model;
+    mat4        normalMatrix;
+    vec4        aabbMin;    // World space, used by the occlusion culling
+    vec4        aabbMax;
+};
+
+// x: object index, y: material index, z: batch index
+layout(binding = 2, std430) readonly buffer InstanceParams
+{
+    uvec4       uInstance[];
+};
+
+// Persistent, only the entities that changed are re-uploaded
+layout(binding = 4, std430) readonly buffer ObjectParams
+{
+    ObjectData  uObjects[];
+};
+
 out vec2 vTexCoord;
 out vec3 vPosition; // In World space
 out vec3 vNormal;   // In World space
 out vec3 vViewDir;  // In World space
-out vec3 vTangent;	
+#ifdef TANGENT_SPACE
+out vec3 vTangent;
 out vec3 vBitangent;
+#endif
+flat out uint vMaterialIdx;
+
+// The depth prepass computes the same position, so this pass can test for equality
+invariant gl_Position;
 
 void main()
 {
+    uvec4 instance = uInstance[aInstanceIdx];
+    mat4 model = uObjects[instance.x].model;
+    mat4 normalMatrix = uObjects[instance.x].normalMatrix;
+    vMaterialIdx = instance.y;
+
     vTexCoord = aTexCoord;
     vPosition = vec3(model * vec4(aPosition, 1.0));
-    vNormal = vec3(model * vec4(aNormal, 0.0));
+    vNormal = vec3(normalMatrix * vec4(aNormal, 0.0));
     vViewDir = vec3(uCameraPosition - vPosition);
+#ifdef TANGENT_SPACE
 	vTangent = normalize(vec3(model * vec4(aTangent, 0.0)));
     vBitangent = normalize(vec3(model * vec4(aBitangent, 0.0)));
+#endif
     gl_Position = projection * view * model * vec4(aPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) //------------------------------------------
 
-struct Light
-{
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
-
 in vec2 vTexCoord;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal; // in worldspace
 in vec3 vViewDir; // in worldspace
+#ifdef TANGENT_SPACE
 in vec3 vTangent;
 in vec3 vBitangent;
+#endif
+flat in uint vMaterialIdx;
+
+struct MaterialData
+{
+    vec4        albedo;   // a: smoothness
+    vec4        emissive;
+    uvec2       albedoTexture;
+    uvec2       normalTexture;
+    uvec2       heightTexture;
+    uvec2       unused;
+};
+
+// The material is the same for every instance of a draw command, so the handles are dynamically uniform
+layout(binding = 3, std430) readonly buffer MaterialParams
+{
+    MaterialData uMaterials[];
+};
 
+#ifdef BINDLESS_TEXTURES
+#define uTexture   sampler2D(uMaterials[vMaterialIdx].albedoTexture)
+#define uNormalTex sampler2D(uMaterials[vMaterialIdx].normalTexture)
+#define uHeightTex sampler2D(uMaterials[vMaterialIdx].heightTexture)
+#else
 uniform sampler2D uTexture;
+#ifdef NORMAL_MAP
 uniform sampler2D uNormalTex;
+#endif
+#ifdef RELIEF_MAP
 uniform sampler2D uHeightTex;
-
-uniform int normalMapBool;
-uniform int heightMapBool;
-
-uniform int texSize;
-uniform int steps;
-
-uniform float uHeightBump;
+#endif
+#endif
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
-	Light uLight[16];
+	unsigned int uLightCapacity;
 };
 
+// The relief only offsets texture coordinates, fragments keep the depth the prepass tested
+layout(depth_unchanged) out float gl_FragDepth;
+
 layout(location = 0) out vec4 oColor;
-layout(location = 1) out vec4 oNormals;
+layout(location = 1) out vec2 oNormals;	// octahedral, the position is reconstructed from depth
 layout(location = 2) out vec4 oAlbedo;
-layout(location = 3) out vec4 oDepth;
-layout(location = 4) out vec4 oPosition;
-
-float near = 0.1; 
-float far  = 100.0;
-
-float DepthCalc(float depth) 
-{
-    float z = depth * 2.0 - 1.0; 
-    return (2.0 * near * far) / (far + near - z * (far - near));	
-}
-
-// Parallax occlusion mapping aka. relief mapping
-vec2 reliefMapping(vec2 texCoords, mat3 tangentSpaceMat)
-{
-
-	 // Compute the view ray in texture space
-	 vec3 rayTexspace = transpose(tangentSpaceMat) * normalize(-vViewDir.xyz);
-	 
-	 // Increment
-	 vec3 rayIncrementTexspace;
-	 rayIncrementTexspace.xy = uHeightBump * rayTexspace.xy / abs(rayTexspace.z * texSize);
-	 rayIncrementTexspace.z = 1.0/steps;
-	 
-	 // Sampling state
-	 vec3 samplePositionTexspace = vec3(texCoords, 0.0);
-	 float sampledDepth = /*1.0 -*/ texture(uHeightTex, samplePositionTexspace.xy).r;
-	 
-	 // Linear search
-	 for (int i = 0; i < steps && samplePositionTexspace.z < sampledDepth; ++i)
-	 {
-		 samplePositionTexspace += rayIncrementTexspace;
-		 sampledDepth = /*1.0 -*/ texture(uHeightTex, samplePositionTexspace.xy).r;
-	 }
-	 return samplePositionTexspace.xy;
-}
+layout(location = 3) out uint oMaterial;	// index into uMaterials, read back by the lighting passes
 
 void main()
 {
-	oPosition = vec4(vPosition,1.0);
-
+    vec3 N = normalize(vNormal);
+#ifdef TANGENT_SPACE
 	vec3 T = normalize(vTangent);
 	vec3 B = normalize(vBitangent);
-    vec3 N = normalize(vNormal);
-	mat3 TBN = mat3(T, B, N);	
-	
+	mat3 TBN = mat3(T, B, N);
+#endif
+
 	vec2 tcoords = vTexCoord;
 
-	if(heightMapBool ==1.0)
-		tcoords = reliefMapping(tcoords, TBN);
+#ifdef RELIEF_MAP
+	tcoords = reliefMapping(uHeightTex, tcoords, TBN, vViewDir);
+#endif
 
-	oAlbedo = texture(uTexture, tcoords);
+	oAlbedo = vec4(texture(uTexture, tcoords).rgb * uMaterials[vMaterialIdx].albedo.rgb, 1.0);
 
-	if (normalMapBool == 1.0)
-	{
-		vec3 tangentSpaceNormal = texture(uNormalTex, tcoords).xyz * 2.0 - vec3(1.0);
-		N = TBN * tangentSpaceNormal;
-	}
+#ifdef NORMAL_MAP
+	vec3 tangentSpaceNormal = texture(uNormalTex, tcoords).xyz * 2.0 - vec3(1.0);
+	N = TBN * tangentSpaceNormal;
+#endif
 	
-	oNormals = vec4(N, 1.0);
-
-
-	float depth = DepthCalc(gl_FragCoord.z) / far; 
-	oDepth = vec4(vec3(depth), 1.0);
+	oNormals = EncodeNormal(normalize(N));
+	oMaterial = vMaterialIdx;
 }
 
 #endif
@@ -449,14 +633,6 @@ void main()
 
 #ifdef Mode_DeferredLighting
 
-struct Light
-{
-    unsigned int    type;
-    vec3            color;
-    vec3            direction;
-    vec3            position;
-};
-
 #if defined(VERTEX)
 
 layout(location = 0) in vec3 aPosition;
@@ -466,60 +642,85 @@ layout(binding = 0, std140) uniform GlobalParams
 {
     vec3            uCameraPosition;
     unsigned int    uLightCount;
-    Light           uLight[16];
+    unsigned int    uLightCapacity;
 };
 
 layout(binding = 1, std140) uniform LocalParams
 {
-    mat4        model;
     mat4        view;
     mat4        projection;
 };
 
 out vec2 vTexCoord;
-out vec3 vPosition; // In World space
 
 void main()
 {
     vTexCoord = aTexCoord;
-    vPosition = vec3(projection * view * model * vec4(uCameraPosition, 1.0));
     gl_Position =  vec4(aPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) //------------------------------------------
 
-struct Light
-{
-	unsigned int type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
-};
-
 in vec2 vTexCoord;
-in vec3 vPosition; // in worldspace
 
-uniform sampler2D oNormals;
+uniform sampler2D oNormals;	// octahedral
 uniform sampler2D oAlbedo;
-uniform sampler2D oDepth;
-uniform sampler2D oPosition;
+uniform usampler2D oMaterial;
+uniform sampler2D oDepth;	// depth attachment
+
+uniform mat4 uInvViewProjection;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
-	Light uLight[16];
+	unsigned int uLightCapacity;
+};
+
+// Lights as three SoA streams of uLightCapacity entries
+layout(binding = 1, std430) readonly buffer LightParams
+{
+	vec4 uLights[];
+};
+
+vec4 LightPositionRadius(uint i) { return uLights[i]; }                      // xyz: position, w: radius
+vec4 LightColorType(uint i)      { return uLights[uLightCapacity + i]; }      // rgb: color, w: type
+vec4 LightDirection(uint i)      { return uLights[2u * uLightCapacity + i]; }
+
+// Only the emissive is read, the G buffer holds the rest of the material
+struct MaterialData
+{
+	vec4 albedo;   // a: smoothness
+	vec4 emissive;
+	uvec2 albedoTexture;
+	uvec2 normalTexture;
+	uvec2 heightTexture;
+	uvec2 unused;
+};
+
+layout(binding = 3, std430) readonly buffer MaterialParams
+{
+	MaterialData uMaterials[];
 };
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-	// G buffer
-	vec3 position = texture(oPosition, vTexCoord).rgb;
-	vec3 Normal = texture(oNormals, vTexCoord).rgb;
+	float depth = texture(oDepth, vTexCoord).r;
+	if(depth == 1.0)
+	{
+		oColor = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+
+	// G buffer, the position is reconstructed from depth
+	vec4 worldPosition = uInvViewProjection * vec4(vTexCoord * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec3 position = worldPosition.xyz / worldPosition.w;
+	vec3 Normal = DecodeNormal(texture(oNormals, vTexCoord).rg);
 	vec3 albedo = texture(oAlbedo, vTexCoord).rgb;
-	vec3 viewDir = normalize(vPosition - position);
+	vec3 emissive = uMaterials[texelFetch(oMaterial, ivec2(gl_FragCoord.xy), 0).r].emissive.rgb;
+	vec3 viewDir = normalize(uCameraPosition - position);
 
 	// Mat parameters
     vec3 specular = vec3(1.0);	// color reflected by mat
@@ -541,50 +742,411 @@ void main()
 		vec3 L = vec3(0.);
 
 		 //If it is a point light, attenuate according to distance
-		if(uLight[i].type == 1)
+		if(LightColorType(i).w == 1.0)
 		{
-			attenuation = 2.0 / length(uLight[i].position - position);
-			L = normalize(uLight[i].position - position);  //Light direction
+			float distance = length(LightPositionRadius(i).xyz - position);
+			float window = clamp(1.0 - pow(distance / LightPositionRadius(i).w, 4.0), 0.0, 1.0);
+			attenuation = 2.0 / distance * window * window; // zero at the light radius
+			L = normalize(LightPositionRadius(i).xyz - position);  //Light direction
 
 		}
 		else
 		{
-			L = normalize(uLight[i].direction);  //Light direction
+			L = normalize(LightDirection(i).xyz);  //Light direction
 		}
 
 	    vec3 R = reflect(-L, N);  //reflected vector
 	    
 	     //Diffuse
 	    float diffuseIntensity = max(0.0, dot(N, L));
-	    diffuseColor += attenuation * albedo.xyz * uLight[i].color * diffuseIntensity;
+	    diffuseColor += attenuation * albedo.xyz * LightColorType(i).rgb * diffuseIntensity;
 	    
 	     //Specular
 	    float specularIntensity = pow(max(dot(R, V), 0.0), shininess);
-	    specularColor += attenuation * specular * uLight[i].color * specularIntensity;
+	    specularColor += attenuation * specular * LightColorType(i).rgb * specularIntensity;
 	}
 
-	oColor = vec4(ambientColor + diffuseColor + specularColor, 1.0);
+	oColor = vec4(ambientColor + diffuseColor + specularColor + emissive, 1.0);
 
 }
 
 #endif
 #endif
 
-//---------------------------------------------------
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+#ifdef Mode_DepthPrepass
 
-#ifdef Mode_BrightestPixels
 #if defined(VERTEX)
 
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec2 aTexCoord;
-
-out vec2 vTexCoord;
+layout(location = 5) in uint aInstanceIdx; // gl_InstanceID + base instance of the draw
 
-void main()
+layout(binding = 1, std140) uniform LocalParams
 {
-    vTexCoord = aTexCoord;
-    gl_Position = vec4(aPosition, 1.0);
-}
+    mat4        view;
+    mat4        projection;
+};
+
+struct ObjectData
+{
+    mat4        model;
+    mat4        normalMatrix;
+    vec4        aabbMin;
+    vec4        aabbMax;
+};
+
+layout(binding = 2, std430) readonly buffer InstanceParams
+{
+    uvec4       uInstance[];
+};
+
+layout(binding = 4, std430) readonly buffer ObjectParams
+{
+    ObjectData  uObjects[];
+};
+
+invariant gl_Position;
+
+void main()
+{
+    mat4 model = uObjects[uInstance[aInstanceIdx].x].model;
+    gl_Position = projection * view * model * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) //------------------------------------------
+
+void main()
+{
+}
+
+#endif
+#endif
+
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+#ifdef Mode_ClusterLights
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define MAX_CLUSTER_LIGHTS 128 // CLUSTER_MAX_LIGHTS in clustered.h
+
+layout(local_size_x = 64) in;
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uLightCount;
+	unsigned int uLightCapacity;
+};
+
+// Lights as three SoA streams of uLightCapacity entries
+layout(binding = 1, std430) readonly buffer LightParams
+{
+	vec4 uLights[];
+};
+
+vec4 LightPositionRadius(uint i) { return uLights[i]; }                      // xyz: position, w: radius
+vec4 LightColorType(uint i)      { return uLights[uLightCapacity + i]; }      // rgb: color, w: type
+vec4 LightDirection(uint i)      { return uLights[2u * uLightCapacity + i]; }
+
+layout(binding = 5, std430) writeonly buffer ClusterGrid
+{
+	uvec2       uClusters[];
+};
+
+layout(binding = 6, std430) writeonly buffer ClusterLights
+{
+	uint        uClusterLights[];
+};
+
+layout(binding = 7, std430) buffer ClusterCounter
+{
+	uint        uClusterLightCount;
+};
+
+uniform mat4 uView;
+uniform mat4 uInvProjection;
+uniform uvec3 uClusterCount;
+uniform float uNear;
+uniform float uFar;
+
+// Point of the view ray through ndc at the given view depth
+vec3 ViewPoint(vec2 ndc, float depth)
+{
+	vec4 far = uInvProjection * vec4(ndc, 1.0, 1.0);
+	vec3 direction = far.xyz / far.w;
+	return direction * (depth / -direction.z);
+}
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if(idx >= uClusterCount.x * uClusterCount.y * uClusterCount.z)
+		return;
+
+	uvec3 cluster = uvec3(idx % uClusterCount.x, (idx / uClusterCount.x) % uClusterCount.y, idx / (uClusterCount.x * uClusterCount.y));
+
+	// View space bounds of the cluster, slices split the depth range exponentially
+	vec2 ndcMin = vec2(cluster.xy) / vec2(uClusterCount.xy) * 2.0 - 1.0;
+	vec2 ndcMax = vec2(cluster.xy + 1u) / vec2(uClusterCount.xy) * 2.0 - 1.0;
+	float depthNear = uNear * pow(uFar / uNear, float(cluster.z) / float(uClusterCount.z));
+	float depthFar = uNear * pow(uFar / uNear, float(cluster.z + 1u) / float(uClusterCount.z));
+
+	vec3 aabbMin = vec3(1e30);
+	vec3 aabbMax = vec3(-1e30);
+	for(int i = 0; i < 8; ++i)
+	{
+		vec2 ndc = vec2((i & 1) != 0 ? ndcMax.x : ndcMin.x, (i & 2) != 0 ? ndcMax.y : ndcMin.y);
+		vec3 corner = ViewPoint(ndc, (i & 4) != 0 ? depthFar : depthNear);
+		aabbMin = min(aabbMin, corner);
+		aabbMax = max(aabbMax, corner);
+	}
+
+	uint lights[MAX_CLUSTER_LIGHTS];
+	uint count = 0u;
+	for(uint i = 0u; i < uLightCount && count < MAX_CLUSTER_LIGHTS; ++i)
+	{
+		bool visible = true;
+		if(LightColorType(i).w == 1.0)
+		{
+			vec3 center = vec3(uView * vec4(LightPositionRadius(i).xyz, 1.0));
+			vec3 closest = clamp(center, aabbMin, aabbMax);
+			vec3 offset = center - closest;
+			visible = dot(offset, offset) <= LightPositionRadius(i).w * LightPositionRadius(i).w;
+		}
+
+		if(visible)
+			lights[count++] = i;
+	}
+
+	uint offset = atomicAdd(uClusterLightCount, count);
+	for(uint i = 0u; i < count; ++i)
+		uClusterLights[offset + i] = lights[i];
+
+	uClusters[idx] = uvec2(offset, count);
+}
+
+#endif
+#endif
+
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------
+
+#ifdef Mode_DeferredLightingTiled
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define TILE_SIZE 16
+#define MAX_TILE_LIGHTS 1024 // lights past it are dropped from the tile
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uLightCount;
+	unsigned int uLightCapacity;
+};
+
+// Lights as three SoA streams of uLightCapacity entries
+layout(binding = 1, std430) readonly buffer LightParams
+{
+	vec4 uLights[];
+};
+
+vec4 LightPositionRadius(uint i) { return uLights[i]; }                      // xyz: position, w: radius
+vec4 LightColorType(uint i)      { return uLights[uLightCapacity + i]; }      // rgb: color, w: type
+vec4 LightDirection(uint i)      { return uLights[2u * uLightCapacity + i]; }
+
+// Only the emissive is read, the G buffer holds the rest of the material
+struct MaterialData
+{
+	vec4 albedo;   // a: smoothness
+	vec4 emissive;
+	uvec2 albedoTexture;
+	uvec2 normalTexture;
+	uvec2 heightTexture;
+	uvec2 unused;
+};
+
+layout(binding = 3, std430) readonly buffer MaterialParams
+{
+	MaterialData uMaterials[];
+};
+
+uniform sampler2D uNormals;
+uniform sampler2D uAlbedo;
+uniform usampler2D uMaterialIds;
+uniform sampler2D uDepth;
+
+uniform mat4 uView;
+uniform mat4 uInvView;
+uniform mat4 uInvProjection;
+
+layout(binding = 0, rgba8) writeonly uniform image2D uOutput;
+
+// View depth bounds of the tile, positive floats keep their order as uints
+shared uint sMinDepth;
+shared uint sMaxDepth;
+shared uint sTileLightCount;
+shared uint sTileLights[MAX_TILE_LIGHTS];
+
+vec3 ViewPosition(vec2 ndc, float depth)
+{
+	vec4 position = uInvProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+// Plane through the eye and two corners of the tile on the far plane, pointing inwards
+vec3 TilePlane(vec3 a, vec3 b)
+{
+	return normalize(cross(a, b));
+}
+
+void main()
+{
+	ivec2 size = imageSize(uOutput);
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	bool inside = texel.x < size.x && texel.y < size.y;
+
+	if(gl_LocalInvocationIndex == 0u)
+	{
+		sMinDepth = 0xFFFFFFFFu;
+		sMaxDepth = 0u;
+		sTileLightCount = 0u;
+	}
+	barrier();
+
+	// Background pixels are left out so they do not stretch the bounds to the far plane
+	float depth = inside ? texelFetch(uDepth, texel, 0).r : 1.0;
+	vec2 ndc = (vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0;
+	vec3 viewPosition = ViewPosition(ndc, depth);
+	bool lit = inside && depth < 1.0;
+	if(lit)
+	{
+		atomicMin(sMinDepth, floatBitsToUint(-viewPosition.z));
+		atomicMax(sMaxDepth, floatBitsToUint(-viewPosition.z));
+	}
+	barrier();
+
+	float minDepth = uintBitsToFloat(sMinDepth);
+	float maxDepth = uintBitsToFloat(sMaxDepth);
+
+	if(sMinDepth <= sMaxDepth)
+	{
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * uint(TILE_SIZE)) / vec2(size) * 2.0 - 1.0;
+		vec2 tileMax = vec2(min(ivec2((gl_WorkGroupID.xy + 1u) * uint(TILE_SIZE)), size)) / vec2(size) * 2.0 - 1.0;
+
+		vec3 bl = ViewPosition(tileMin, 1.0);
+		vec3 br = ViewPosition(vec2(tileMax.x, tileMin.y), 1.0);
+		vec3 tl = ViewPosition(vec2(tileMin.x, tileMax.y), 1.0);
+		vec3 tr = ViewPosition(tileMax, 1.0);
+
+		vec3 planes[4];
+		planes[0] = TilePlane(bl, tl);
+		planes[1] = TilePlane(tr, br);
+		planes[2] = TilePlane(br, bl);
+		planes[3] = TilePlane(tl, tr);
+
+		// Each thread tests a strided subset of the lights
+		for(uint i = gl_LocalInvocationIndex; i < uLightCount; i += uint(TILE_SIZE * TILE_SIZE))
+		{
+			bool visible = true;
+			if(LightColorType(i).w == 1.0)
+			{
+				vec3 center = vec3(uView * vec4(LightPositionRadius(i).xyz, 1.0));
+				float radius = LightPositionRadius(i).w;
+
+				visible = -center.z + radius >= minDepth && -center.z - radius <= maxDepth;
+				for(int p = 0; p < 4 && visible; ++p)
+					visible = dot(planes[p], center) >= -radius;
+			}
+
+			if(visible)
+			{
+				uint slot = atomicAdd(sTileLightCount, 1u);
+				if(slot < MAX_TILE_LIGHTS)
+					sTileLights[slot] = i;
+			}
+		}
+	}
+	barrier();
+
+	if(!inside)
+		return;
+
+	if(!lit)
+	{
+		imageStore(uOutput, texel, vec4(0.0, 0.0, 0.0, 1.0));
+		return;
+	}
+
+	// G buffer
+	vec3 position = vec3(uInvView * vec4(viewPosition, 1.0));
+	vec3 N = DecodeNormal(texelFetch(uNormals, texel, 0).rg);
+	vec3 albedo = texelFetch(uAlbedo, texel, 0).rgb;
+	vec3 emissive = uMaterials[texelFetch(uMaterialIds, texel, 0).r].emissive.rgb;
+	vec3 V = normalize(uCameraPosition - position);
+
+	// Mat parameters
+	vec3 specular = vec3(1.0);
+	float shininess = 40.0;
+
+	vec3 ambientColor = albedo * 0.5;
+	vec3 diffuseColor = vec3(0.0);
+	vec3 specularColor = vec3(0.0);
+
+	uint tileLightCount = min(sTileLightCount, uint(MAX_TILE_LIGHTS));
+	for(uint t = 0u; t < tileLightCount; ++t)
+	{
+		uint i = sTileLights[t];
+		float attenuation = 0.3;
+		vec3 L;
+
+		if(LightColorType(i).w == 1.0)
+		{
+			float distance = length(LightPositionRadius(i).xyz - position);
+			float window = clamp(1.0 - pow(distance / LightPositionRadius(i).w, 4.0), 0.0, 1.0);
+			attenuation = 2.0 / distance * window * window;
+			L = normalize(LightPositionRadius(i).xyz - position);
+		}
+		else
+		{
+			L = normalize(LightDirection(i).xyz);
+		}
+
+		vec3 R = reflect(-L, N);
+		diffuseColor += attenuation * albedo * LightColorType(i).rgb * max(0.0, dot(N, L));
+		specularColor += attenuation * specular * LightColorType(i).rgb * pow(max(dot(R, V), 0.0), shininess);
+	}
+
+	imageStore(uOutput, texel, vec4(ambientColor + diffuseColor + specularColor + emissive, 1.0));
+}
+
+#endif
+#endif
+
+//---------------------------------------------------
+
+#ifdef Mode_BrightestPixels
+#if defined(VERTEX)
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+    vTexCoord = aTexCoord;
+    gl_Position = vec4(aPosition, 1.0);
+}
 
 #elif defined(FRAGMENT)
 
@@ -611,7 +1173,7 @@ void main()
 //--------------------------------------------------------------
 //--------------------------------------------------------------
 
-#ifdef Mode_Blur
+#ifdef Mode_BlurSeparable
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -628,41 +1190,29 @@ void main()
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-uniform sampler2D colorMap;
-uniform vec2 direction;
-uniform int inputLod;
-uniform int kernelRadius;
+// BLUR_TAP_COUNT, BLUR_OFFSETS and BLUR_WEIGHTS come from the kernel (blur.cpp). Tap 0 is the
+// center, the others are bilinear fetches between two texels, taken on both sides
+const float offsets[BLUR_TAP_COUNT] = BLUR_OFFSETS;
+const float weights[BLUR_TAP_COUNT] = BLUR_WEIGHTS;
+
+uniform sampler2D uInput;
+uniform vec2 uDirection;
+uniform int uInputLod;
 
 in vec2 vTexCoord;
 out vec4 oColor;
 
 void main()
 {
-    vec2 texSize = textureSize(colorMap, inputLod);
-	vec2 texelSize = 1.0/texSize;
-	vec2 margin1 = texelSize * 0.5;
-	vec2 margin2 = vec2(1.0) - margin1;
-
-	oColor = vec4(0.0);
+	vec2 texelStep = uDirection / vec2(textureSize(uInput, uInputLod));
 
-	vec2 directionFragCoord = gl_FragCoord.xy * direction;
-	int coord = int(directionFragCoord.x + directionFragCoord.y);
-	vec2 directionTexSize = texSize * direction;
-	int size = int(directionTexSize.x + directionTexSize.y);
-	int kernelBegin = -min(kernelRadius, coord);
-	int kernelEnd = min(kernelRadius, size - coord);
-	float weight = 0.0;
-
-	for(int i = kernelBegin; i <= kernelEnd; ++i)
+	oColor = textureLod(uInput, vTexCoord, uInputLod) * weights[0];
+	for(int i = 1; i < BLUR_TAP_COUNT; ++i)
 	{
-		float currentWeight = smoothstep(float(kernelRadius), 0.0, float(abs(i)));
-		vec2 finalTexCoords = vTexCoord + i * direction * texelSize;
-	    finalTexCoords = clamp(finalTexCoords, margin1, margin2);
-		oColor += textureLod(colorMap, finalTexCoords, inputLod) * currentWeight;
-		weight += currentWeight;		
+		vec2 offset = texelStep * offsets[i];
+		oColor += textureLod(uInput, vTexCoord + offset, uInputLod) * weights[i];
+		oColor += textureLod(uInput, vTexCoord - offset, uInputLod) * weights[i];
 	}
-
-	oColor = oColor / weight;
 }
 
 #endif
@@ -689,13 +1239,11 @@ void main()
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
+#define BLOOM_MAX_LEVELS 8
+
 uniform sampler2D colorMap;
 uniform int maxLOD;
-uniform float LOD0;
-uniform float LOD1;
-uniform float LOD2;
-uniform float LOD3;
-uniform float LOD4;
+uniform float uIntensity[BLOOM_MAX_LEVELS];
 
 in vec2 vTexCoord;
 out vec4 oColor;
@@ -705,16 +1253,7 @@ void main()
 	oColor = vec4(0.0);
 	for(int LOD = 0; LOD < maxLOD; ++LOD)
 	{
-		if(LOD == 0)
-			oColor += textureLod(colorMap, vTexCoord, float(LOD)) * LOD0;
-		else if (LOD == 1)
-			oColor += textureLod(colorMap, vTexCoord, float(LOD)) * LOD1;
-		else if (LOD == 2)
-			oColor += textureLod(colorMap, vTexCoord, float(LOD)) * LOD2;
-		else if (LOD == 3)
-			oColor += textureLod(colorMap, vTexCoord, float(LOD)) * LOD3;
-		else if (LOD == 4)
-			oColor += textureLod(colorMap, vTexCoord, float(LOD)) * LOD4;
+		oColor += textureLod(colorMap, vTexCoord, float(LOD)) * uIntensity[LOD];
 	}
 	oColor.a = 1.0;
 }
@@ -722,4 +1261,462 @@ void main()
 #endif
 #endif
 
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+#ifdef Mode_BloomDownsample
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// An output texel covers 2x2 source texels and the filter reaches 2 texels past them,
+// so a group of 8x8 outputs reads a 20x20 source tile
+#define TILE_SIZE 20
+
+uniform sampler2D uSource;
+uniform int uSourceLevel;
+uniform int uPrefilter;     // first level: threshold and Karis average
+uniform float uThreshold;
+
+layout(binding = 0, rgba16f) writeonly uniform image2D uOutput;
+
+shared vec3 sTile[TILE_SIZE][TILE_SIZE];
+
+float Luma(vec3 color)
+{
+	return dot(color, vec3(0.21, 0.71, 0.08));
+}
+
+// Average of the 2x2 tile texels starting at p, what a bilinear tap between them returns
+vec3 Box(ivec2 p)
+{
+	return 0.25 * (sTile[p.y][p.x] + sTile[p.y][p.x + 1] + sTile[p.y + 1][p.x] + sTile[p.y + 1][p.x + 1]);
+}
+
+void main()
+{
+	ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * 16 - 2;
+
+	// Every source texel is fetched once, clamped to the edge like the sampler would
+	for(uint i = gl_LocalInvocationIndex; i < uint(TILE_SIZE * TILE_SIZE); i += 64u)
+	{
+		ivec2 t = ivec2(i % uint(TILE_SIZE), i / uint(TILE_SIZE));
+		vec3 color = texelFetch(uSource, clamp(tileOrigin + t, ivec2(0), sourceSize - 1), uSourceLevel).rgb;
+		if(uPrefilter != 0)
+			color *= smoothstep(uThreshold, uThreshold + 0.1, Luma(color));
+		sTile[t.y][t.x] = color;
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(uOutput);
+	if(texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	// 13 tap downsample (Jimenez, Next Generation Post Processing in Call of Duty: Advanced Warfare),
+	// c is the first source texel the output covers
+	ivec2 c = ivec2(gl_LocalInvocationID.xy) * 2 + 2;
+	vec3 a = Box(c + ivec2(-2, -2));
+	vec3 b = Box(c + ivec2( 0, -2));
+	vec3 d = Box(c + ivec2( 2, -2));
+	vec3 e = Box(c + ivec2(-2,  0));
+	vec3 f = Box(c);
+	vec3 g = Box(c + ivec2( 2,  0));
+	vec3 h = Box(c + ivec2(-2,  2));
+	vec3 i = Box(c + ivec2( 0,  2));
+	vec3 j = Box(c + ivec2( 2,  2));
+	vec3 k = Box(c + ivec2(-1, -1));
+	vec3 l = Box(c + ivec2( 1, -1));
+	vec3 m = Box(c + ivec2(-1,  1));
+	vec3 n = Box(c + ivec2( 1,  1));
+
+	vec3 groups[5] = vec3[5]((k + l + m + n) * 0.25, (a + b + e + f) * 0.25, (b + d + f + g) * 0.25, (e + f + h + i) * 0.25, (f + g + i + j) * 0.25);
+	float weights[5] = float[5](0.5, 0.125, 0.125, 0.125, 0.125);
+
+	// The Karis average weights the groups by their inverse luma, so a single bright texel
+	// doesn't flicker through the whole chain
+	vec3 color = vec3(0.0);
+	float total = 0.0;
+	for(int group = 0; group < 5; ++group)
+	{
+		float weight = weights[group];
+		if(uPrefilter != 0)
+			weight /= 1.0 + Luma(groups[group]);
+		color += groups[group] * weight;
+		total += weight;
+	}
+
+	imageStore(uOutput, texel, vec4(color / total, 1.0));
+}
+
+#endif
+#endif
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+#ifdef Mode_BloomUpsample
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uChain;
+uniform int uLevel;             // level written, uLevel + 1 is upsampled into it
+uniform float uIntensity;       // weight of the downsampled level itself
+uniform float uLowerIntensity;  // weight of the lower level, 1 once it was accumulated
+
+layout(binding = 0, rgba16f) uniform image2D uOutput;
+
+// A group of 8x8 outputs interpolates 6x6 tent filtered texels of the lower level, which read 8x8 of it
+shared vec3 sLower[8][8];
+shared vec3 sTent[6][6];
+
+void main()
+{
+	int lowerLevel = uLevel + 1;
+	ivec2 lowerSize = textureSize(uChain, lowerLevel);
+	ivec2 lowerOrigin = ivec2(gl_WorkGroupID.xy) * 4 - 2;
+
+	ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	sLower[local.y][local.x] = texelFetch(uChain, clamp(lowerOrigin + local, ivec2(0), lowerSize - 1), lowerLevel).rgb;
+	barrier();
+
+	// 3x3 tent (1 2 1) over the lower level
+	if(local.x < 6 && local.y < 6)
+	{
+		ivec2 p = local + 1;
+		vec3 tent = 4.0 * sLower[p.y][p.x];
+		tent += 2.0 * (sLower[p.y][p.x - 1] + sLower[p.y][p.x + 1] + sLower[p.y - 1][p.x] + sLower[p.y + 1][p.x]);
+		tent += sLower[p.y - 1][p.x - 1] + sLower[p.y - 1][p.x + 1] + sLower[p.y + 1][p.x - 1] + sLower[p.y + 1][p.x + 1];
+		sTent[local.y][local.x] = tent / 16.0;
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(uOutput);
+	if(texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	// Bilinear interpolation of the tent filtered texels, sTent[0][0] is lower texel lowerOrigin + 1
+	vec2 position = (vec2(texel) + 0.5) * 0.5 - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 weight = position - vec2(base);
+	ivec2 t = base - (lowerOrigin + 1);
+	vec3 upsampled = mix(mix(sTent[t.y][t.x], sTent[t.y][t.x + 1], weight.x),
+	                     mix(sTent[t.y + 1][t.x], sTent[t.y + 1][t.x + 1], weight.x), weight.y);
+
+	vec3 color = imageLoad(uOutput, texel).rgb;
+	imageStore(uOutput, texel, vec4(color * uIntensity + upsampled * uLowerIntensity, 1.0));
+}
+
+#endif
+#endif
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+#ifdef Mode_BloomComposite
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uBloom;   // level 0 of the chain, filtered linearly up to the render size
+uniform float uIntensity;
+
+layout(binding = 0, rgba8) uniform image2D uColor;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(uColor);
+	if(texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+	vec3 bloom = textureLod(uBloom, uv, 0.0).rgb * uIntensity;
+
+	vec4 color = imageLoad(uColor, texel);
+	imageStore(uColor, texel, vec4(color.rgb + bloom, color.a));
+}
+
+#endif
+#endif
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+#ifdef Mode_HiZ
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uDepth;
+uniform int uLevel;
+
+layout(binding = 0, r32f) readonly uniform image2D uSrc;
+layout(binding = 1, r32f) writeonly uniform image2D uDst;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 dstSize = imageSize(uDst);
+	if(texel.x >= dstSize.x || texel.y >= dstSize.y)
+		return;
+
+	if(uLevel == 0)
+	{
+		imageStore(uDst, texel, vec4(texelFetch(uDepth, texel, 0).r));
+		return;
+	}
+
+	// Farthest depth of the footprint, odd sizes fold the extra row and column in
+	ivec2 srcSize = imageSize(uSrc);
+	ivec2 src = texel * 2;
+	ivec2 last = srcSize - 1;
+	float depth = max(max(imageLoad(uSrc, min(src, last)).r, imageLoad(uSrc, min(src + ivec2(1, 0), last)).r),
+	                  max(imageLoad(uSrc, min(src + ivec2(0, 1), last)).r, imageLoad(uSrc, min(src + ivec2(1, 1), last)).r));
+
+	bool extraColumn = (srcSize.x & 1) != 0 && texel.x == dstSize.x - 1;
+	bool extraRow = (srcSize.y & 1) != 0 && texel.y == dstSize.y - 1;
+	if(extraColumn)
+	{
+		depth = max(depth, imageLoad(uSrc, min(src + ivec2(2, 0), last)).r);
+		depth = max(depth, imageLoad(uSrc, min(src + ivec2(2, 1), last)).r);
+	}
+	if(extraRow)
+	{
+		depth = max(depth, imageLoad(uSrc, min(src + ivec2(0, 2), last)).r);
+		depth = max(depth, imageLoad(uSrc, min(src + ivec2(1, 2), last)).r);
+	}
+	if(extraColumn && extraRow)
+		depth = max(depth, imageLoad(uSrc, min(src + ivec2(2, 2), last)).r);
+
+	imageStore(uDst, texel, vec4(depth));
+}
+
+#endif
+#endif
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
 
+#ifdef Mode_OcclusionCull
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 64) in;
+
+struct ObjectData
+{
+	mat4        model;
+	mat4        normalMatrix;
+	vec4        aabbMin;
+	vec4        aabbMax;
+};
+
+struct DrawCommand
+{
+	uint        count;
+	uint        instanceCount;
+	uint        firstIndex;
+	int         baseVertex;
+	uint        baseInstance;
+};
+
+// x: object index, y: material index, z: batch index
+layout(binding = 2, std430) readonly buffer InstanceParams
+{
+	uvec4       uInstance[];
+};
+
+layout(binding = 4, std430) readonly buffer ObjectParams
+{
+	ObjectData  uObjects[];
+};
+
+// One command per batch, the instance counts start at zero
+layout(binding = 5, std430) buffer DrawCommands
+{
+	DrawCommand uCommands[];
+};
+
+layout(binding = 6, std430) writeonly buffer CulledInstances
+{
+	uvec4       uCulledInstance[];
+};
+
+// 1 when the instance was drawn by the first phase
+layout(binding = 7, std430) buffer InstanceVisibility
+{
+	uint        uVisible[];
+};
+
+layout(binding = 8, std430) buffer OcclusionStats
+{
+	uint        uDrawnFirst;
+	uint        uDrawnSecond;
+	uint        uCulled;
+};
+
+uniform mat4 uViewProjection;
+uniform uint uPhase;
+uniform uint uInstanceCount;
+uniform int uHiZValid;
+uniform int uHiZLevels;
+uniform sampler2D uHiZ;
+
+bool IsVisible(vec3 aabbMin, vec3 aabbMax)
+{
+	vec3 rectMin = vec3(1.0);
+	vec3 rectMax = vec3(-1.0);
+	for(int i = 0; i < 8; ++i)
+	{
+		vec3 corner = vec3((i & 1) != 0 ? aabbMax.x : aabbMin.x,
+		                   (i & 2) != 0 ? aabbMax.y : aabbMin.y,
+		                   (i & 4) != 0 ? aabbMax.z : aabbMin.z);
+		vec4 clip = uViewProjection * vec4(corner, 1.0);
+
+		// Crossing the near plane, the projected rect is meaningless
+		if(clip.w <= 0.0)
+			return true;
+
+		vec3 ndc = clip.xyz / clip.w;
+		rectMin = min(rectMin, ndc);
+		rectMax = max(rectMax, ndc);
+	}
+
+	vec2 uvMin = clamp(rectMin.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uvMax = clamp(rectMax.xy * 0.5 + 0.5, 0.0, 1.0);
+	float nearestDepth = rectMin.z * 0.5 + 0.5;
+
+	// Pick the level where the rect spans at most 2x2 texels
+	vec2 size = vec2(textureSize(uHiZ, 0));
+	vec2 extent = (uvMax - uvMin) * size;
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, uHiZLevels - 1);
+
+	ivec2 levelSize = textureSize(uHiZ, level);
+	ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+	float maxDepth = max(max(texelFetch(uHiZ, texelMin, level).r, texelFetch(uHiZ, ivec2(texelMax.x, texelMin.y), level).r),
+	                     max(texelFetch(uHiZ, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(uHiZ, texelMax, level).r));
+
+	return nearestDepth <= maxDepth;
+}
+
+void Emit(uvec4 instance)
+{
+	uint slot = atomicAdd(uCommands[instance.z].instanceCount, 1u);
+	uCulledInstance[uCommands[instance.z].baseInstance + slot] = instance;
+}
+
+void main()
+{
+	uint idx = gl_GlobalInvocationID.x;
+	if(idx >= uInstanceCount)
+		return;
+
+	uvec4 instance = uInstance[idx];
+	ObjectData object = uObjects[instance.x];
+
+	if(uPhase == 0u)
+	{
+		bool visible = uHiZValid == 0 || IsVisible(object.aabbMin.xyz, object.aabbMax.xyz);
+		uVisible[idx] = visible ? 1u : 0u;
+		if(visible)
+		{
+			Emit(instance);
+			atomicAdd(uDrawnFirst, 1u);
+		}
+	}
+	else if(uVisible[idx] == 0u)
+	{
+		if(IsVisible(object.aabbMin.xyz, object.aabbMax.xyz))
+		{
+			Emit(instance);
+			atomicAdd(uDrawnSecond, 1u);
+		}
+		else
+		{
+			atomicAdd(uCulled, 1u);
+		}
+	}
+}
+
+#endif
+#endif
+
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+//------------------------------------------------------------------
+
+#ifdef Mode_GBufferDebug
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#define VIEW_DEPTH    1
+#define VIEW_ALBEDO   2
+#define VIEW_NORMAL   3
+#define VIEW_POSITION 4
+
+uniform sampler2D uNormals;
+uniform sampler2D uAlbedo;
+uniform sampler2D uDepth;
+
+uniform int uView;
+uniform mat4 uInvViewProjection;
+uniform mat4 uProjection;
+uniform float uDepthRange;
+
+layout(binding = 0, rgba8) writeonly uniform image2D uOutput;
+
+// Decodes the compact G-buffer into something displayable, the image stores clamp to [0, 1]
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(uOutput);
+	if(texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	float depth = texelFetch(uDepth, texel, 0).r;
+	vec3 color = vec3(0.0);
+
+	if(uView == VIEW_DEPTH)
+	{
+		// Linear view depth, 1 at the far plane
+		float ndcZ = depth * 2.0 - 1.0;
+		float linearDepth = uProjection[3][2] / (ndcZ + uProjection[2][2]);
+		color = vec3(linearDepth / uDepthRange);
+	}
+	else if(uView == VIEW_ALBEDO)
+	{
+		color = texelFetch(uAlbedo, texel, 0).rgb;
+	}
+	else if(depth < 1.0 && uView == VIEW_NORMAL)
+	{
+		color = DecodeNormal(texelFetch(uNormals, texel, 0).rg);
+	}
+	else if(depth < 1.0 && uView == VIEW_POSITION)
+	{
+		vec2 ndc = (vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0;
+		vec4 position = uInvViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+		color = position.xyz / position.w;
+	}
+
+	imageStore(uOutput, texel, vec4(color, 1.0));
+}
+
+#endif
+#endif